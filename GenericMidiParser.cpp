@@ -16,7 +16,20 @@
  */
 /* Includes */
 #include "GenericMidiParser.hpp"
+#include "MidiFileSource.hpp"
+#include "MidiVoiceTable.hpp"
+#include "MidiPortSink.hpp"
+#include "MidiTracer.hpp"
 
+#ifdef MIDI_FILE_SOURCE_ONLY
+GenericMidiParser::GenericMidiParser(MidiFileSource* file_source,
+		void (*us_delay_fnct)(uint32_t us),
+		void (*assert_error_callback)(uint8_t errorCode)) :
+		us_delay_fnct(us_delay_fnct), assert_error_callback(
+				assert_error_callback), file_source(file_source), note_on_callback(
+				0), note_off_callback(0), control_change_callback(0), patch_change_callback(
+				0), pitch_bend_callback(0) {
+#else
 GenericMidiParser::GenericMidiParser(uint8_t (*file_read_fnct)(void),
 		void (*file_fseek_fnct)(uint32_t address),
 		uint32_t (*file_ftell_fnct)(void), uint8_t (*file_eof_fnct)(void),
@@ -24,25 +37,95 @@ GenericMidiParser::GenericMidiParser(uint8_t (*file_read_fnct)(void),
 		void (*assert_error_callback)(uint8_t errorCode)) :
 		file_read_fnct(file_read_fnct), file_fseek_fnct(file_fseek_fnct), file_ftell_fnct(
 				file_ftell_fnct), file_eof_fnct(file_eof_fnct), us_delay_fnct(
-				us_delay_fnct), assert_error_callback(assert_error_callback), note_on_callback(
-				0), note_off_callback(0), key_after_touch_callback(0), control_change_callback(
-				0), patch_change_callback(0), channel_after_touch_callback(0), pitch_bend_callback(
-				0), meta_callback(0), meta_onChannel_prefix(0), meta_onPort_prefix(
-				0), time_signature_callback(0), key_signature_callback(0) {
+				us_delay_fnct), assert_error_callback(assert_error_callback), file_source(
+				0), note_on_callback(0), note_off_callback(0), control_change_callback(
+				0), patch_change_callback(0), pitch_bend_callback(0) {
+#endif
+#ifndef MIDI_NO_EXTENSIONS
+	voice_tracker = 0;
+	port_router = 0;
+#endif
+#ifndef MIDI_NO_AFTER_TOUCH_CALLBACKS
+	key_after_touch_callback = 0;
+	channel_after_touch_callback = 0;
+#endif
+#ifndef MIDI_NO_META_CALLBACKS
+	meta_callback = 0;
+	meta_onChannel_prefix = 0;
+	meta_onPort_prefix = 0;
+	time_signature_callback = 0;
+	key_signature_callback = 0;
+#endif
+#ifndef MIDI_NO_MULTIPLE_SONG
+	setSequenceIndex(0, 0);
+	sequences_number = 0; // Unknown until load()
+	current_sequence = 0;
+#endif
+#ifndef MIDI_NO_FILTERS
+	clearFilters();
+#endif
+}
+
+uint8_t GenericMidiParser::fileRead() {
+#ifdef MIDI_FILE_SOURCE_ONLY
+	return file_source->read();
+#else
+	if (file_source)
+		return file_source->read();
+	return file_read_fnct();
+#endif
+}
+
+void GenericMidiParser::fileSeek(uint32_t address) {
+	fileSeek(address, current_track_number);
+}
+
+void GenericMidiParser::fileSeek(uint32_t address, uint8_t owner) {
+#ifdef MIDI_FILE_SOURCE_ONLY
+	file_source->seek(address, owner);
+#else
+	if (file_source)
+		file_source->seek(address, owner);
+	else
+		file_fseek_fnct(address);
+#endif
+}
 
+uint32_t GenericMidiParser::fileTell() {
+#ifdef MIDI_FILE_SOURCE_ONLY
+	return file_source->tell();
+#else
+	if (file_source)
+		return file_source->tell();
+	return file_ftell_fnct();
+#endif
+}
+
+uint8_t GenericMidiParser::fileEof() {
+#ifdef MIDI_FILE_SOURCE_ONLY
+	return file_source->eof();
+#else
+	if (file_source)
+		return file_source->eof();
+	return file_eof_fnct();
+#endif
 }
 
 uint32_t GenericMidiParser::readByte() {
+#ifndef MIDI_COMPACT_TRACKS
 	tracks[current_track_number].trackSize--;
+#endif
 	tracks[current_track_number].trackPointer++;
-	return file_read_fnct();
+	return fileRead();
 }
 
 void GenericMidiParser::readBytes(uint8_t* buf, uint8_t len) {
+#ifndef MIDI_COMPACT_TRACKS
 	tracks[current_track_number].trackSize -= len;
+#endif
 	tracks[current_track_number].trackPointer += len;
 	for (uint8_t i = 0; i < len; i++)
-		buf[i] = file_read_fnct();
+		buf[i] = fileRead();
 }
 
 void GenericMidiParser::dropBytes(uint8_t len) {
@@ -62,6 +145,27 @@ uint32_t GenericMidiParser::readVarLenValue() {
 	return value;
 }
 
+uint32_t GenericMidiParser::readFixedValue(uint8_t len) {
+	uint32_t value = 0;
+	while (len--)
+		value = (value << 8) | readByte(); // Big endian
+	return value;
+}
+
+void GenericMidiParser::setFileSource(MidiFileSource* file_source) {
+	this->file_source = file_source;
+}
+
+#ifndef MIDI_NO_EXTENSIONS
+void GenericMidiParser::setVoiceTracker(MidiVoiceTable* voice_tracker) {
+	this->voice_tracker = voice_tracker;
+}
+
+void GenericMidiParser::setPortRouter(MidiPortSink* port_router) {
+	this->port_router = port_router;
+}
+#endif
+
 void GenericMidiParser::setNoteOnCallback(
 		void (*note_on_callback)(uint8_t channel, uint8_t key,
 				uint8_t velocity)) {
@@ -74,12 +178,20 @@ void GenericMidiParser::setNoteOffCallback(
 	this->note_off_callback = note_off_callback;
 }
 
+#ifndef MIDI_NO_AFTER_TOUCH_CALLBACKS
 void GenericMidiParser::setKeyAfterTouchCallback(
 		void (*key_after_touch_callback)(uint8_t channel, uint8_t key,
 				uint8_t pressure)) {
 	this->key_after_touch_callback = key_after_touch_callback;
 }
 
+void GenericMidiParser::setChannelAfterTouchCallback(
+		void (*channel_after_touch_callback)(uint8_t channel,
+				uint8_t pressure)) {
+	this->channel_after_touch_callback = channel_after_touch_callback;
+}
+#endif
+
 void GenericMidiParser::setControlChangeCallback(
 		void (*control_change_callback)(uint8_t channel, uint8_t controller,
 				uint8_t data)) {
@@ -91,17 +203,12 @@ void GenericMidiParser::setPatchChangeCallback(
 	this->patch_change_callback = patch_change_callback;
 }
 
-void GenericMidiParser::setChannelAfterTouchCallback(
-		void (*channel_after_touch_callback)(uint8_t channel,
-				uint8_t pressure)) {
-	this->channel_after_touch_callback = channel_after_touch_callback;
-}
-
 void GenericMidiParser::setPitchBendCallback(
 		void (*pitch_bend_callback)(uint8_t channel, uint16_t bend)) {
 	this->pitch_bend_callback = pitch_bend_callback;
 }
 
+#ifndef MIDI_NO_META_CALLBACKS
 void GenericMidiParser::setMetaCallback(
 		void (*meta_callback)(uint8_t metaType, uint8_t dataLength)) {
 	this->meta_callback = meta_callback;
@@ -128,6 +235,54 @@ void GenericMidiParser::setKeySignatureCallback(
 				uint8_t majorMinor)) {
 	this->key_signature_callback = key_signature_callback;
 }
+#endif
+
+#ifndef MIDI_NO_FILTERS
+void GenericMidiParser::setEventFilter(uint16_t channelMask, uint8_t typeMask) {
+	for (uint8_t i = 0; i < 7; i++)
+		channel_filter[i] = (typeMask & (1 << i)) ? channelMask : 0;
+	sysex_accepted = (typeMask & FILTER_SYSEX) != 0;
+	updateFilterState();
+}
+
+void GenericMidiParser::setChannelFilter(uint16_t channelMask,
+		uint8_t typeMask) {
+	for (uint8_t i = 0; i < 7; i++)
+		if (typeMask & (1 << i))
+			channel_filter[i] = channelMask;
+	updateFilterState();
+}
+
+void GenericMidiParser::setMetaFilter(uint8_t metaType, uint8_t accepted) {
+	metaType &= 0x7F;
+	if (accepted)
+		meta_filter[metaType >> 3] |= 1 << (metaType & 7);
+	else
+		meta_filter[metaType >> 3] &= ~(1 << (metaType & 7));
+	updateFilterState();
+}
+
+void GenericMidiParser::clearFilters() {
+	uint8_t i;
+	for (i = 0; i < 7; i++)
+		channel_filter[i] = 0xFFFF;
+	for (i = 0; i < 16; i++)
+		meta_filter[i] = 0xFF;
+	sysex_accepted = true;
+	filter_active = false;
+}
+
+void GenericMidiParser::updateFilterState() {
+	uint8_t i;
+	filter_active = !sysex_accepted;
+	for (i = 0; i < 7; i++)
+		if (channel_filter[i] != 0xFFFF)
+			filter_active = true;
+	for (i = 0; i < 16; i++)
+		if (meta_filter[i] != 0xFF)
+			filter_active = true;
+}
+#endif
 
 uint8_t GenericMidiParser::processHeader() {
 	DEBUG("Beginning header parsing ...");
@@ -136,22 +291,36 @@ uint8_t GenericMidiParser::processHeader() {
 	readBytes((uint8_t*) MThd, 4);
 	DEBUG("Header : %x %x %x %x", MThd[0], MThd[1], MThd[2], MThd[3]);
 
-	header.headerSize = (readByte() << 24) | (readByte() << 16)
-			| (readByte() << 8) | readByte();
-	DEBUG("HeaderSize : %d", header.headerSize);
+	uint32_t headerSize = readFixedValue(4); // Only 6 is valid, not kept
+	DEBUG("HeaderSize : %d", headerSize);
 
-	header.formatType = (readByte() << 8) | readByte();
-	DEBUG("Format type : %d", header.formatType);
+	uint16_t formatType = readFixedValue(2);
+	DEBUG("Format type : %d", formatType);
 
-	header.numberOfTracks = (readByte() << 8) | readByte();
-	DEBUG("Number of track : %d", header.numberOfTracks);
+	uint16_t numberOfTracks = readFixedValue(2); // Stored on 8 bits once stripped down
+	DEBUG("Number of track : %d", numberOfTracks);
 
-	if (header.numberOfTracks > MAX_TRACKS_NUMBERS) {
+#ifndef MIDI_NO_MULTIPLE_SONG
+	header.formatType = (formatType < 0xFF) ? formatType : 0xFF; // Unknown formats stay unknown
+	if (formatType == MULTILPLE_SONG_FILE) {
+		DEBUG("Multiple songs file, %d sequences", numberOfTracks);
+		if (sequences_number != numberOfTracks)
+			index_ready = false; // Another file, see also seekSequence()
+		sequences_number = numberOfTracks;
+		numberOfTracks = 1; // One sequence at the time
+	} else {
+		sequences_number = 1;
+		index_ready = false; // Only format 2 files are indexed
+	}
+#endif
+
+	if (numberOfTracks > MAX_TRACKS_NUMBERS) {
 		DEBUG("Number of track stripped down to %d", MAX_TRACKS_NUMBERS);
-		header.numberOfTracks = MAX_TRACKS_NUMBERS;
+		numberOfTracks = MAX_TRACKS_NUMBERS;
 	}
+	header.numberOfTracks = numberOfTracks;
 
-	header.timeDivision = (readByte() << 8) | readByte();
+	header.timeDivision = readFixedValue(2);
 	DEBUG("Time division : %d", header.timeDivision);
 
 	if (MThd[0] != 0x4D || MThd[1] != 0x54 || MThd[2] != 0x68
@@ -161,28 +330,34 @@ uint8_t GenericMidiParser::processHeader() {
 	}
 	DEBUG("Header check: PASS");
 
-	if (header.headerSize != 0x06) {
+	if (headerSize != 0x06) {
 		DEBUG("Header size check: ERROR");
 		return BAD_FILE_HEADER;
 	}
 	DEBUG("Header size check: PASS");
 
-	if (header.formatType == MULTILPLE_SONG_FILE) {
+#ifdef MIDI_NO_MULTIPLE_SONG
+	if (formatType == MULTILPLE_SONG_FILE) {
 		DEBUG("Fileformat check: ERROR");
 		return NO_MULTIPLE_SONG_SUPPORT;
 	}
 	DEBUG("Fileformat check: PASS");
+#endif
 
 	if (header.timeDivision < 0) {
 		DEBUG("Time division check: ERROR");
 		return NO_SMPTE_SUPPORT; // TODO
 	}
+	if (header.timeDivision == 0) {
+		DEBUG("Time division check: ERROR");
+		return BAD_FILE_HEADER; // Delta times could not be converted
+	}
 	DEBUG("Time division check: PASS");
 
 	tempo = 500000; // Default tempo
 	DEBUG("Tempo: %d", tempo);
 
-	if (file_eof_fnct()) {
+	if (fileEof()) {
 		DEBUG("File struct check: ERROR");
 		return BAD_FILE_STRUCT;
 	}
@@ -199,9 +374,8 @@ uint8_t GenericMidiParser::processTrack() {
 	readBytes((uint8_t*) MTrk, 4);
 	DEBUG("Header : %x %x %x %x", MTrk[0], MTrk[1], MTrk[2], MTrk[3]);
 
-	tracks[current_track_number].trackSize = (readByte() << 24)
-			| (readByte() << 16) | (readByte() << 8) | readByte();
-	DEBUG("TrackSize : %d", tracks[current_track_number].trackSize);
+	uint32_t trackSize = readFixedValue(4);
+	DEBUG("TrackSize : %d", trackSize);
 
 	if (MTrk[0] != 0x4D || MTrk[1] != 0x54 || MTrk[2] != 0x72
 			|| MTrk[3] != 0x6B) {
@@ -210,140 +384,217 @@ uint8_t GenericMidiParser::processTrack() {
 	}
 	DEBUG("Header check: PASS");
 
-	tracks[current_track_number].trackPointer = file_ftell_fnct();
-	DEBUG("Track pointer : %x", tracks[current_track_number].trackPointer);
+	uint32_t trackPointer = fileTell();
+	DEBUG("Track pointer : %x", trackPointer);
 
+#ifdef MIDI_COMPACT_TRACKS
+	// Track addresses are stored on MIDI_FILE_ADDRESS_BITS bits, they must not wrap
+	if (trackPointer >= (1UL << MIDI_FILE_ADDRESS_BITS)
+			|| trackSize >= (1UL << MIDI_FILE_ADDRESS_BITS) - trackPointer) {
+		DEBUG("Track out of the addressable range");
+		return BAD_FILE_STRUCT;
+	}
+#else
+	tracks[current_track_number].trackSize = trackSize;
+#endif
+	tracks[current_track_number].trackPointer = trackPointer;
+	tracks[current_track_number].runningStatus = NO_RUNNING_STATUS;
 	tracks[current_track_number].done = false;
 
+	fileSeek(trackPointer + trackSize, HEADERS_OWNER); // Next track header
+
 	DEBUG("Track parsing done !");
 	return NO_ERROR;
 }
 
-void GenericMidiParser::processTime() {
-	file_fseek_fnct(tracks[current_track_number].trackPointer);
-	DEBUG("Process DeltaTime from track %d", current_track_number);
+#ifndef MIDI_NO_MULTIPLE_SONG
+uint8_t GenericMidiParser::seekSequence() {
+	uint8_t error;
 
-	uint32_t deltaTime = readVarLenValue();
-	DEBUG("Delta time: %d", deltaTime);
+	if (current_sequence >= sequences_number)
+		return BAD_SEQUENCE_INDEX;
 
-	DEBUG("TimeDivision: %d", header.timeDivision);
-	DEBUG("Tempo: %d", tempo);
-	DEBUG("DeltaTime: %d", deltaTime);
-	tracks[current_track_number].waitTime = deltaTime
-			* ((float) tempo / header.timeDivision);
-}
+	// Another file with as many sequences may have been opened since the index was built
+	if (index_ready && current_sequence < sequence_index_size
+			&& !checkSequenceIndex(current_sequence))
+		index_ready = false;
 
-uint8_t GenericMidiParser::processEvent() {
-	file_fseek_fnct(tracks[current_track_number].trackPointer);
-	DEBUG("Process Event from track %d", current_track_number);
+	if (sequence_index && !index_ready) {
+		error = walkSequences(0xFFFF); // Index every sequences once
+		if (error)
+			return error;
+		index_ready = true;
+	}
 
-	uint8_t cmd = readByte();
-	uint8_t nybble = (cmd & 0xF0) >> 4;
-	static uint8_t channel = 0;
+	if (sequence_index && current_sequence < sequence_index_size) {
+		fileSeek(sequence_index[current_sequence].offset, HEADERS_OWNER);
+		return NO_ERROR;
+	}
 
-	DEBUG("Command: %x", cmd);
-	DEBUG("Nybble: %x", nybble);
+	return walkSequences(current_sequence); // Not indexed, walk the chunks headers
+}
 
-	if (cmd < 0x80) { // Runnning status
-		DEBUG("Event: Runnning status");
-		DEBUG("Channel: %d", channel);
+uint8_t GenericMidiParser::checkSequenceIndex(uint16_t index) {
+	char id[4];
 
-		uint8_t velocity = readByte();
+	fileSeek(sequence_index[index].offset, HEADERS_OWNER);
+	readBytes((uint8_t*) id, 4);
+	return id[0] == 0x4D && id[1] == 0x54 && id[2] == 0x72 && id[3] == 0x6B
+			&& readFixedValue(4) == sequence_index[index].length && !fileEof();
+}
 
-		if (velocity > 0) {
-			if (note_on_callback)
-				note_on_callback(channel, cmd, velocity);
-		} else {
-			if (note_off_callback)
-				note_off_callback(channel, cmd, velocity);
+uint8_t GenericMidiParser::walkSequences(uint16_t target) {
+	uint32_t address = 8 + 6, length; // First chunk after the file header
+	uint16_t n = 0;
+	char id[4];
+
+	while (n < sequences_number) {
+		fileSeek(address, HEADERS_OWNER);
+		readBytes((uint8_t*) id, 4);
+		length = readFixedValue(4);
+		if (fileEof())
+			return BAD_FILE_STRUCT;
+
+		// Unknown chunks are skipped (events are never decoded here)
+		if (id[0] == 0x4D && id[1] == 0x54 && id[2] == 0x72 && id[3] == 0x6B) {
+			if (target == 0xFFFF && n < sequence_index_size) { // Building the index
+				sequence_index[n].offset = address;
+				sequence_index[n].length = length;
+				sequence_index[n].duration = SEQUENCE_NOT_SCANNED;
+				sequence_index[n].nameOffset = 0;
+				sequence_index[n].nameLength = 0;
+			}
+			if (n == target) {
+				fileSeek(address, HEADERS_OWNER);
+				return NO_ERROR;
+			}
+			n++;
 		}
+		address += 8 + length;
 	}
 
-	channel = cmd & 0x0F;
-	DEBUG("Channel: %d", channel);
+	return (target == 0xFFFF) ? NO_ERROR : BAD_SEQUENCE_INDEX;
+}
+#endif
 
-	switch (nybble) {
-	case 0x08: // note off
-		DEBUG("Event: Note Off");
-		if (note_off_callback)
-			note_off_callback(channel, readByte(), readByte());
-		else
-			dropBytes(2);
-		break;
+uint8_t GenericMidiParser::processTime() {
+	fileSeek(tracks[current_track_number].trackPointer);
+	DEBUG("Process DeltaTime from track %d", current_track_number);
 
-	case 0x09: // note on
-		DEBUG("Event: Note On");
-		if (note_on_callback)
-			note_on_callback(channel, readByte(), readByte());
-		else
-			dropBytes(2);
-		break;
+	uint32_t deltaTime = readVarLenValue();
+	DEBUG("Delta time: %d", deltaTime);
 
-	case 0x0A: // key after-touch
-		DEBUG("Event: Key after touch");
-		if (key_after_touch_callback)
-			key_after_touch_callback(channel, readByte(), readByte());
-		else
-			dropBytes(2);
-		break;
+#ifdef MIDI_SHORT_TRACKS
+	if (deltaTime > 0xFFFFFF) {
+		DEBUG("Delta time out of the 24 bits range");
+		return BAD_FILE_STRUCT;
+	}
+#endif
 
-	case 0x0B: // control change
-		DEBUG("Event: Control change");
-		if (control_change_callback)
-			control_change_callback(channel, readByte(), readByte());
-		else
-			dropBytes(2);
-		break;
+	// Kept in ticks, the scheduler convert the elapsed ticks with the tempo of the moment
+	tracks[current_track_number].waitTime = deltaTime;
+	return NO_ERROR;
+}
 
-	case 0x0C: // program change
-		DEBUG("Event: Program change");
-		if (patch_change_callback)
-			patch_change_callback(channel, readByte());
-		else
-			readByte();
-		break;
+uint8_t GenericMidiParser::processEvent(MidiEvent* event) {
+	fileSeek(tracks[current_track_number].trackPointer);
+	DEBUG("Process Event from track %d", current_track_number);
 
-	case 0x0D: // channel after touch
-		DEBUG("Event: Channel after touch");
-		if (channel_after_touch_callback)
-			channel_after_touch_callback(channel, readByte());
-		else
-			readByte();
-		break;
+	uint8_t cmd = readByte();
+	DEBUG("Command: %x", cmd);
 
-	case 0x0E: // pitch wheel change
-		DEBUG("Event: Pitch wheel change");
-		if (pitch_bend_callback)
-			pitch_bend_callback(channel, readByte());
-		else
-			readByte();
-		break;
+	event->time = current_time;
+	event->length = 0;
+	event->track = current_track_number;
+	event->metaType = 0;
 
-	case 0x0F: // meta
+	if (cmd < 0x80) { // Runnning status
+		DEBUG("Event: Runnning status");
+		if (tracks[current_track_number].runningStatus == NO_RUNNING_STATUS)
+			return BAD_FILE_STRUCT;
+		event->status = 0x80 | tracks[current_track_number].runningStatus;
+		event->data[0] = cmd;
+	} else {
+		event->status = cmd;
+		if (cmd < 0xF0)
+			tracks[current_track_number].runningStatus = cmd & 0x7F;
+	}
+
+	uint8_t nybble = event->status >> 4;
+	event->channel = event->status & 0x0F;
+	DEBUG("Channel: %d", event->channel);
+
+	if (nybble == 0x0F) { // meta
 		DEBUG("Event: Meta");
-		if ((errno = processMeta(cmd)))
-			return errno;
-		break;
+		return processMeta(event);
 	}
 
+	// 1 data byte for program change and channel after touch, 2 for others
+	uint8_t dataLen = (nybble == 0x0C || nybble == 0x0D) ? 1 : 2;
+
+#ifndef MIDI_NO_FILTERS
+	// Running status note on may turn into an accepted note off, decode it
+	if (!(channel_filter[nybble - 8] & (1 << event->channel))
+			&& !(cmd < 0x80 && nybble == 0x09
+					&& (channel_filter[0] & (1 << event->channel)))) {
+		DEBUG("Event: Filtered");
+		dropBytes((cmd < 0x80) ? dataLen - 1 : dataLen);
+		payload_end = tracks[current_track_number].trackPointer;
+		event->status = 0;
+		return NO_ERROR;
+	}
+#endif
+
+	if (cmd >= 0x80)
+		event->data[0] = readByte();
+	if (dataLen == 2)
+		event->data[1] = readByte();
+
+	// Note on with velocity 0 in running status is a note off
+	if (cmd < 0x80 && nybble == 0x09 && event->data[1] == 0)
+		event->status = 0x80 | event->channel;
+
+#ifndef MIDI_NO_FILTERS
+	if (!(channel_filter[(event->status >> 4) - 8] & (1 << event->channel)))
+		event->status = 0; // Filtered note on
+#endif
+
+	payload_end = tracks[current_track_number].trackPointer;
 	return NO_ERROR;
 }
 
-uint8_t GenericMidiParser::processMeta(uint8_t cmd) {
-	if (cmd == 0xFF) {
+uint8_t GenericMidiParser::processMeta(MidiEvent* event) {
+	if (event->status == 0xFF) {
 		DEBUG("Meta type: normal");
 
-		uint8_t metaCmd = readByte();
-		uint32_t dataLen = readVarLenValue();
-		DEBUG("Meta Command: %x", metaCmd);
-		DEBUG("Meta length: %d", dataLen);
+		event->metaType = readByte();
+		event->length = readVarLenValue();
+		DEBUG("Meta Command: %x", event->metaType);
+		DEBUG("Meta length: %d", event->length);
+#ifdef MIDI_COMPACT_TRACKS
+		if (event->length >= (1UL << MIDI_FILE_ADDRESS_BITS)
+				- tracks[current_track_number].trackPointer)
+			return BAD_META_EVENT; // Past the addressable range
+#endif
+		payload_end = tracks[current_track_number].trackPointer + event->length;
+
+#ifndef MIDI_NO_FILTERS
+		// End of track and tempo are needed by the scheduler, never filtered
+		if (event->metaType != 0x2F && event->metaType != 0x51
+				&& !((meta_filter[(event->metaType & 0x7F) >> 3]
+						>> (event->metaType & 7)) & 1)) {
+			DEBUG("Meta Event: Filtered");
+			event->status = 0;
+			return NO_ERROR;
+		}
+#endif
 
-		switch (metaCmd) {
+		switch (event->metaType) {
 		case 0x00: // Set track's sequence number
 			DEBUG("Meta Event: set track number");
-			if (dataLen != 0x02)
+			if (event->length != 0x02)
 				return BAD_META_EVENT;
-			//current_track_number = (readByte() << 8) | readByte(); // TODO
+			readBytes(event->data, 2);
 			break;
 
 		case 0x01: // Text event- any text you want.
@@ -353,101 +604,71 @@ uint8_t GenericMidiParser::processMeta(uint8_t cmd) {
 		case 0x05: // Lyric
 		case 0x06: // Marker
 		case 0x07: // Cue point
+		case 0x7F: // Sequencer specific information
 			DEBUG("Meta Event: text or similar");
-			if (dataLen == 0)
+			if (event->length == 0)
 				return BAD_META_EVENT;
-			if (meta_callback)
-				meta_callback(metaCmd, dataLen);
-			else
-				dropBytes(dataLen);
-			break;
+			break; // Payload is left to the consumer
 
 		case 0x20: // Midi Channel Prefix
 			DEBUG("Meta Event: Channel prefix");
-			if (dataLen != 1)
+			if (event->length != 1)
 				return BAD_META_EVENT;
-			if (meta_onChannel_prefix)
-				meta_onChannel_prefix(readByte());
-			else
-				readByte();
+			event->data[0] = readByte();
 			break;
 
 		case 0x21: // Midi Port Prefix
 			DEBUG("Meta Event: Port prefix");
-			if (dataLen != 1)
+			if (event->length != 1)
 				return BAD_META_EVENT;
-			if (meta_onPort_prefix)
-				meta_onPort_prefix(readByte());
-			else
-				readByte();
+			event->data[0] = readByte();
 			break;
 
 		case 0x2F: // This event MUST come at the end of each tracks
 			DEBUG("Meta Event: End of track");
-			if (dataLen != 0x00)
+			if (event->length != 0x00)
 				return BAD_META_EVENT;
 			tracks[current_track_number].done = true;
-			track_finished++;
 			DEBUG("End of track %d", current_track_number);
 			break;
 
 		case 0x51: // Set tempoSet tempo
 			DEBUG("Meta Event: Set tempo");
-			if (dataLen != 0x03)
+			if (event->length != 0x03)
 				return BAD_META_EVENT;
-			tempo = (readByte() << 16) | (readByte() << 8) | readByte();
+			readBytes(event->data, 3);
+			tempo = ((uint32_t) event->data[0] << 16)
+					| ((uint32_t) event->data[1] << 8) | event->data[2];
 			DEBUG("Tempo: %d", tempo);
 			break;
 
 		case 0x54: // SMTPE Offset TODO
 			DEBUG("Meta Event: SMTPE offset");
-			if (dataLen != 0x05)
+			if (event->length != 0x05)
 				return BAD_META_EVENT;
-			dropBytes(5);
-			/*uint8_t hours = readByte();
-			 uint8_t minutes = readByte();
-			 uint8_t seconds = readByte();
-			 uint8_t frames = readByte();
-			 uint8_t fractional = readByte();*/
-			// SMTPE not implemented
+			// SMTPE not implemented, payload skipped
 			break;
 
 		case 0x58: // Time Signature
 			DEBUG("Meta Event: Time signature");
-			if (dataLen != 0x04)
+			if (event->length != 0x04)
 				return BAD_META_EVENT;
-			if (time_signature_callback)
-				time_signature_callback(readByte(), readByte(), readByte(),
-						readByte());
-			else
-				dropBytes(4);
+			readBytes(event->data, 4);
 			break;
 
 		case 0x59: // Key signature
 			DEBUG("Meta Event: Key signature");
-			if (dataLen != 0x02)
+			if (event->length != 0x02)
 				return BAD_META_EVENT;
-			if (key_signature_callback)
-				key_signature_callback(readByte(), readByte());
-			else
-				dropBytes(2);
-			break;
-
-		case 0x7F: // Sequencer specific information
-			DEBUG("Meta Event: Sequencer specific");
-			if (dataLen == 0)
-				return BAD_META_EVENT;
-			if (meta_callback)
-				meta_callback(META_SEQUENCER, dataLen);
-			else
-				dropBytes(dataLen);
+			readBytes(event->data, 2);
 			break;
 		}
 
 	} else {
 		DEBUG("Meta type: sysex");
+		payload_end = tracks[current_track_number].trackPointer;
 
-		switch (cmd) {
+		switch (event->status) {
 		case 0xF8: // Timing Clock Request
 			DEBUG("Meta Event: Timing clock request");
 			break;
@@ -470,15 +691,26 @@ uint8_t GenericMidiParser::processMeta(uint8_t cmd) {
 		case 0xF0: // sysex event
 		case 0xF7: // sysex event
 			DEBUG("Meta Event: Sysex message");
-			uint32_t dataLen = readVarLenValue();
-			DEBUG("Sysex length: %d", dataLen);
+			event->length = readVarLenValue();
+			DEBUG("Sysex length: %d", event->length);
+#ifdef MIDI_COMPACT_TRACKS
+			if (event->length >= (1UL << MIDI_FILE_ADDRESS_BITS)
+					- tracks[current_track_number].trackPointer)
+				return BAD_META_EVENT; // Past the addressable range
+#endif
+			payload_end = tracks[current_track_number].trackPointer
+					+ event->length;
+
+#ifndef MIDI_NO_FILTERS
+			if (!sysex_accepted) {
+				DEBUG("Meta Event: Filtered");
+				event->status = 0;
+				return NO_ERROR;
+			}
+#endif
 
-			if (dataLen == 0)
+			if (event->length == 0)
 				return BAD_META_EVENT;
-			if (meta_callback)
-				meta_callback(META_SYSEX, dataLen);
-			else
-				dropBytes(dataLen);
 			break;
 		}
 	}
@@ -486,6 +718,157 @@ uint8_t GenericMidiParser::processMeta(uint8_t cmd) {
 	return NO_ERROR;
 }
 
+#ifndef MIDI_NO_EXTENSIONS
+uint8_t GenericMidiParser::trackVoice(const MidiEvent* event) {
+	MidiVoice stolen;
+	uint8_t port = port_router ? port_router->getTrackPort(event->track) : 0;
+
+	switch (event->status >> 4) {
+	case 0x08: // note off
+		return voice_tracker->noteOff(event->channel, event->data[0], port);
+
+	case 0x09: // note on
+		if (event->data[1] == 0) {
+			voice_tracker->noteOff(event->channel, event->data[0], port);
+			break;
+		}
+		switch (voice_tracker->noteOn(event->channel, event->data[0],
+				event->data[1], event->time, &stolen, port)) {
+		case MidiVoiceTable::VOICE_DROPPED:
+			return false;
+
+		case MidiVoiceTable::VOICE_STOLEN:
+			sendNoteOff(stolen.port, stolen.channel, stolen.key); // Victim own port
+			break;
+		}
+		break;
+	}
+
+	return true;
+}
+
+void GenericMidiParser::sendNoteOff(uint8_t port, uint8_t channel,
+		uint8_t key) {
+	if (port_router) {
+		uint8_t data[3] = { (uint8_t) (0x80 | channel), key, 0 };
+		port_router->push(port, data, 3);
+	}
+	if (note_off_callback)
+		note_off_callback(channel, key, 0);
+}
+#endif
+
+void GenericMidiParser::dispatchEvent(const MidiEvent* event) {
+#ifndef MIDI_NO_EXTENSIONS
+	if (voice_tracker && !trackVoice(event))
+		return; // Not sounding, or dropped by the polyphony limit
+	if (port_router)
+		port_router->route(event);
+#endif
+
+	switch (event->status >> 4) {
+	case 0x08: // note off
+		DEBUG("Event: Note Off");
+		if (note_off_callback)
+			note_off_callback(event->channel, event->data[0], event->data[1]);
+		break;
+
+	case 0x09: // note on
+		DEBUG("Event: Note On");
+		if (note_on_callback)
+			note_on_callback(event->channel, event->data[0], event->data[1]);
+		break;
+
+#ifndef MIDI_NO_AFTER_TOUCH_CALLBACKS
+	case 0x0A: // key after-touch
+		DEBUG("Event: Key after touch");
+		if (key_after_touch_callback)
+			key_after_touch_callback(event->channel, event->data[0],
+					event->data[1]);
+		break;
+#endif
+
+	case 0x0B: // control change
+		DEBUG("Event: Control change");
+		if (control_change_callback)
+			control_change_callback(event->channel, event->data[0],
+					event->data[1]);
+		break;
+
+	case 0x0C: // program change
+		DEBUG("Event: Program change");
+		if (patch_change_callback)
+			patch_change_callback(event->channel, event->data[0]);
+		break;
+
+#ifndef MIDI_NO_AFTER_TOUCH_CALLBACKS
+	case 0x0D: // channel after touch
+		DEBUG("Event: Channel after touch");
+		if (channel_after_touch_callback)
+			channel_after_touch_callback(event->channel, event->data[0]);
+		break;
+#endif
+
+	case 0x0E: // pitch wheel change
+		DEBUG("Event: Pitch wheel change");
+		if (pitch_bend_callback)
+			pitch_bend_callback(event->channel,
+					event->data[0] | (event->data[1] << 7));
+		break;
+
+#ifndef MIDI_NO_META_CALLBACKS
+	case 0x0F: // meta
+		if (event->status == 0xF0 || event->status == 0xF7) {
+			if (meta_callback)
+				meta_callback(META_SYSEX, event->length);
+			break;
+		}
+		if (event->status != 0xFF)
+			break;
+
+		switch (event->metaType) {
+		case 0x01:
+		case 0x02:
+		case 0x03:
+		case 0x04:
+		case 0x05:
+		case 0x06:
+		case 0x07:
+			if (meta_callback)
+				meta_callback(event->metaType, event->length);
+			break;
+
+		case 0x20:
+			if (meta_onChannel_prefix)
+				meta_onChannel_prefix(event->data[0]);
+			break;
+
+		case 0x21:
+			if (meta_onPort_prefix)
+				meta_onPort_prefix(event->data[0]);
+			break;
+
+		case 0x58:
+			if (time_signature_callback)
+				time_signature_callback(event->data[0], event->data[1],
+						event->data[2], event->data[3]);
+			break;
+
+		case 0x59:
+			if (key_signature_callback)
+				key_signature_callback(event->data[0], event->data[1]);
+			break;
+
+		case 0x7F:
+			if (meta_callback)
+				meta_callback(META_SEQUENCER, event->length);
+			break;
+		}
+		break;
+#endif
+	}
+}
+
 uint8_t GenericMidiParser::minTime(uint32_t *min) {
 	uint8_t i, found = false;
 
@@ -503,62 +886,313 @@ uint8_t GenericMidiParser::minTime(uint32_t *min) {
 	return found;
 }
 
-void GenericMidiParser::play() {
-	file_fseek_fnct(0);
+uint32_t GenericMidiParser::ticksToTime(uint32_t ticks) {
+	uint16_t division = header.timeDivision;
+	uint32_t time;
 
-	errno = processHeader();
-	if (errno) {
-		assert_error_callback(errno);
-		return;
+	DEBUG("Ticks: %d", ticks);
+	DEBUG("TimeDivision: %d", header.timeDivision);
+	DEBUG("Tempo: %d", tempo);
+
+	// Integer conversion, the remainder is carried so truncation errors do not add up
+	// 32 bits maths when the product surely fit (most delta times), 64 bits maths are slow on AVR
+	if (ticks < 0x10000 && ((ticks >> 8) + 1) * ((tempo >> 8) + 1) < 0xFFFF) {
+		uint32_t scaled = ticks * tempo + time_remainder;
+		time = scaled / division;
+		time_remainder = scaled % division;
+	} else {
+		uint64_t scaled = (uint64_t) ticks * tempo + time_remainder;
+		time = scaled / division;
+		time_remainder = scaled % division;
+	}
+	return time;
+}
+
+uint8_t GenericMidiParser::load() {
+	current_track_number = 0;
+	fileSeek(0, HEADERS_OWNER);
+
+	errnum = processHeader();
+#ifndef MIDI_NO_MULTIPLE_SONG
+	if (!errnum && header.formatType == MULTILPLE_SONG_FILE)
+		errnum = seekSequence();
+#endif
+	if (errnum) {
+		assert_error_callback(errnum);
+		return errnum;
 	}
 
 	for (current_track_number = 0; current_track_number < header.numberOfTracks;
 			current_track_number++) {
-		errno = processTrack();
-		if (errno) {
-			assert_error_callback(errno);
-			return;
+		errnum = processTrack();
+		if (errnum) {
+			assert_error_callback(errnum);
+			return errnum;
 		}
-		file_fseek_fnct(
-				tracks[current_track_number].trackPointer
-						+ tracks[current_track_number].trackSize);
 	}
 
-	DEBUG("Start playing ...");
-	paused = false;
-	track_finished = 0;
+	current_time = 0;
+	time_remainder = 0;
 
 	for (current_track_number = 0; current_track_number < header.numberOfTracks;
-			current_track_number++)
-		processTime();
+			current_track_number++) {
+#ifndef MIDI_NO_FILTERS
+		if (filter_active && isTrackFiltered()) {
+			DEBUG("Track %d fully filtered, skipped", current_track_number);
+			tracks[current_track_number].done = true;
+			continue;
+		}
+#endif
+		errnum = processTime();
+		if (errnum) {
+			assert_error_callback(errnum);
+			return errnum;
+		}
+	}
+	payload_end = 0; // No event pending (the filters walk use it)
+	paused = false;
+
+	// current_track_number == numberOfTracks, next call to nextEvent() start a new round
+	return NO_ERROR;
+}
+
+uint8_t GenericMidiParser::nextEvent(MidiEvent* event, uint8_t timed) {
+	uint32_t minWaitTicks, waitTime;
+	uint8_t i, error = NO_ERROR;
+
+	if (payload_end) // Consumer may have read the payload meanwhile
+		error = finishEvent();
+
+	while (!error) {
+		if (current_track_number >= header.numberOfTracks) {
+			if (!minTime(&minWaitTicks) || fileEof())
+				return false; // Every tracks done (or stopped)
+
+			waitTime = ticksToTime(minWaitTicks);
+			if (timed) {
+				TRACE_BEGIN(waitStart);
+				us_delay_fnct(waitTime);
+				TRACE_END(waitStart, MidiTracer::TRACE_WAIT, TRACE_LANE_SCHEDULER,
+						0, waitTime);
+			}
+			current_time += waitTime;
+
+			for (i = 0; i < header.numberOfTracks; i++)
+				if (!tracks[i].done)
+					tracks[i].waitTime -= minWaitTicks;
+			current_track_number = 0;
+		}
+
+		if (!tracks[current_track_number].done
+				&& tracks[current_track_number].waitTime == 0) {
+			TRACE_BEGIN(decodeStart);
+			error = processEvent(event);
+			TRACE_END(decodeStart, MidiTracer::TRACE_DECODE, current_track_number,
+					event->status, tracks[current_track_number].trackPointer);
+			if (error)
+				break;
+			if (!event->status) { // Filtered out at decode time
+				error = finishEvent();
+				continue;
+			}
+			return true; // Pending until the next call (payload_end is set)
+		}
+		current_track_number++;
+	}
+
+	errnum = error;
+	assert_error_callback(error);
+	header.numberOfTracks = 0; // Song stopped, see stop()
+	payload_end = 0;
+	return false;
+}
 
-	uint32_t minWaitTime = 0;
-	while (track_finished != header.numberOfTracks && !file_eof_fnct()) {
+uint8_t GenericMidiParser::finishEvent() {
+	uint8_t error = NO_ERROR;
 
-		while (paused) {
+	tracks[current_track_number].trackPointer = payload_end;
+	payload_end = 0;
+	if (!tracks[current_track_number].done)
+		error = processTime();
+	current_track_number++;
+	return error;
+}
+
+#ifndef MIDI_NO_FILTERS
+uint8_t GenericMidiParser::isTrackFiltered() {
+	TrackHeader saved = tracks[current_track_number];
+	uint32_t savedTempo = tempo; // The walk decode tempo and sequence control events
+	uint8_t savedPaused = paused;
+#ifdef MIDI_COMPACT_TRACKS
+	uint32_t trackEnd = 0xFFFFFFFF; // Track size not kept, stop at end of track
+#else
+	uint32_t trackEnd = saved.trackPointer + saved.trackSize;
+#endif
+	uint8_t filtered = true;
+	MidiEvent event;
+
+	// Walk the track with the same decoder, stop at the first accepted event
+	while (tracks[current_track_number].trackPointer < trackEnd && !fileEof()) {
+		if (processTime() || processEvent(&event)) {
+			filtered = false; // Let the scheduler report the error
+			break;
+		}
+		if (tracks[current_track_number].done)
+			break; // End of track
+		if (event.status) {
+			filtered = false;
+			break;
 		}
+		tracks[current_track_number].trackPointer = payload_end;
+	}
+
+	tracks[current_track_number] = saved;
+	tempo = savedTempo;
+	paused = savedPaused;
+	return filtered;
+}
+#endif
+
+#ifndef MIDI_NO_MULTIPLE_SONG
+void GenericMidiParser::setSequenceIndex(MidiSequence* table, uint16_t size) {
+	sequence_index = table;
+	sequence_index_size = size;
+	index_ready = false; // Built by the next load()
+}
 
-		minTime(&minWaitTime);
-		us_delay_fnct(minWaitTime);
-
-		for (current_track_number = 0;
-				current_track_number < header.numberOfTracks;
-				current_track_number++)
-			if (tracks[current_track_number].waitTime > minWaitTime)
-				tracks[current_track_number].waitTime -= minWaitTime;
-			else if (!tracks[current_track_number].done) {
-				errno = processEvent();
-				if (errno) {
-					assert_error_callback(errno);
-					return;
+uint16_t GenericMidiParser::getSequencesNumber() const {
+	return sequences_number;
+}
+
+uint8_t GenericMidiParser::selectSequence(uint16_t index) {
+	allNotesOff();
+	if (sequences_number && index >= sequences_number)
+		return BAD_SEQUENCE_INDEX;
+	current_sequence = index; // Loaded by the next load() (play(), events(), ...)
+	return NO_ERROR;
+}
+
+uint8_t GenericMidiParser::scanSequence(uint16_t index) {
+	uint16_t saved = current_sequence;
+	MidiEvent event;
+
+	current_sequence = index;
+	if (load() == NO_ERROR) {
+		if (!index_ready || index >= sequence_index_size)
+			errnum = BAD_SEQUENCE_INDEX; // Not a format 2 file, or not indexed
+		else {
+			MidiSequence& sequence = sequence_index[index];
+			sequence.duration = 0;
+			while (nextEvent(&event, false)) {
+				sequence.duration = event.time;
+				if (event.status == 0xFF && event.metaType == META_TRACK_NAME
+						&& sequence.nameOffset == 0) {
+					sequence.nameOffset = fileTell();
+					sequence.nameLength =
+							(event.length > 0xFF) ? 0xFF : event.length;
 				}
-				processTime();
 			}
+		}
+	}
+
+	current_sequence = saved;
+	return errnum;
+}
+
+uint8_t GenericMidiParser::getSequenceName(uint16_t index, char* buf,
+		uint8_t size) {
+	uint8_t len = 0;
+
+	if (size == 0)
+		return 0; // No room for the terminator
+	if (index_ready && index < sequence_index_size
+			&& sequence_index[index].nameOffset) {
+		len = sequence_index[index].nameLength;
+		if (len >= size)
+			len = size - 1;
+		fileSeek(sequence_index[index].nameOffset, HEADERS_OWNER);
+		for (uint8_t i = 0; i < len; i++)
+			buf[i] = fileRead();
+	}
+	buf[len] = '\0';
+	return len;
+}
+#endif
+
+GenericMidiParser::EventRange GenericMidiParser::events(uint8_t timed) {
+	return EventRange(this, timed);
+}
+
+void GenericMidiParser::play() {
+	MidiEvent event;
+
+	if (load())
+		return;
+	TRACE_SONG_START(); // Not in load(), a preload would move the origin of the playing song
+
+	DEBUG("Start playing ...");
+	for (;;) {
+
+		if (paused) {
+			allNotesOff();
+			while (paused) {
+			}
+		}
+
+		if (!nextEvent(&event, true))
+			break;
+		TRACE_BEGIN(dispatchStart);
+		dispatchEvent(&event);
+		TRACE_END(dispatchStart, MidiTracer::TRACE_CALLBACK, event.track,
+				event.status, event.time);
 	}
 
+	allNotesOff(); // Song done or stopped
 	DEBUG("End of midi song ...");
 }
 
+GenericMidiParser::EventRange::EventRange(GenericMidiParser* parser,
+		uint8_t timed) :
+		parser(parser), timed(timed) {
+}
+
+GenericMidiParser::EventIterator GenericMidiParser::EventRange::begin() const {
+	if (parser->load())
+		return end();
+	TRACE_SONG_START();
+	return EventIterator(parser, timed);
+}
+
+GenericMidiParser::EventIterator GenericMidiParser::EventRange::end() const {
+	return EventIterator(0, timed);
+}
+
+GenericMidiParser::EventIterator::EventIterator(GenericMidiParser* parser,
+		uint8_t timed) :
+		parser(parser), timed(timed) {
+	if (parser && !parser->nextEvent(&event, timed))
+		this->parser = 0;
+}
+
+const MidiEvent& GenericMidiParser::EventIterator::operator*() const {
+	return event;
+}
+
+const MidiEvent* GenericMidiParser::EventIterator::operator->() const {
+	return &event;
+}
+
+GenericMidiParser::EventIterator& GenericMidiParser::EventIterator::operator++() {
+	if (parser && !parser->nextEvent(&event, timed))
+		parser = 0;
+	return *this;
+}
+
+bool GenericMidiParser::EventIterator::operator!=(
+		const EventIterator& other) const {
+	return parser != other.parser;
+}
+
 void GenericMidiParser::pause() {
 	paused = true;
 }
@@ -568,17 +1202,32 @@ void GenericMidiParser::resume() {
 }
 
 void GenericMidiParser::stop() {
-	track_finished = header.numberOfTracks;
+	header.numberOfTracks = 0; // No track left to schedule, load() again to restart
+}
+
+void GenericMidiParser::allNotesOff() {
+#ifndef MIDI_NO_EXTENSIONS
+	MidiVoice voice;
+
+	if (!voice_tracker)
+		return;
+	while (voice_tracker->popVoice(&voice))
+		sendNoteOff(voice.port, voice.channel, voice.key); // Only where it sound
+#endif
 }
 
 uint8_t GenericMidiParser::getErrno() const {
-	return errno;
+	return errnum;
 }
 
 uint32_t GenericMidiParser::getTempo() const {
 	return tempo;
 }
 
+uint32_t GenericMidiParser::getTime() const {
+	return current_time;
+}
+
 void GenericMidiParser::setTempo(uint32_t tempo) {
 	this->tempo = tempo;
 }
@@ -29,9 +29,24 @@
  * - 16/04/2012 : First release (under GNU GPL V3 licence)
  * - 17/04/2012 : Add simultanous multiple tracks support
  *              : Add debug macro
+ * - 18/10/2026 : Add optional RAM page cache (see MidiPageCache.hpp)
+ *              : Add file source interface for cache and prefetch layers
+ *              : Add asynchronous prefetch layer (see MidiPrefetcher.hpp)
+ *              : Split event decoding and callbacks dispatch, add events iterator
+ *              : Add optional active voices tracking (see MidiVoiceTracker.hpp)
+ *              : Add audio block renderer (see MidiBlockRenderer.hpp)
+ *              : Add decode time channel, event type and meta type filters
+ *              : Add batch transform stage (see MidiTransform.hpp)
+ *              : Add multi-port output routing (see MidiPortRouter.hpp)
+ *              : Add optional timeline tracer (see MidiTracer.hpp)
+ *              : Add gapless playlist player (see MidiPlaylist.hpp)
+ *              : Add format 2 (multiple songs) files support with sequences index
+ *              : Add compact build profiles for low RAM targets
  *
  * @section other_sec Others notes and compatibility warning
- * This version can handle simultaneous tracks parsing (limit of simutaneous tracks is defined in header file).
+ * This version can handle simultaneous tracks parsing (limit of simutaneous tracks is defined in header file).\n
+ * Format 2 files are played one sequence (track) at the time, see selectSequence().\n
+ * The build profile (and others MIDI_NO_xxx options) change the class layout, it must be the same for every files.
  */
 
 #ifndef GENERICMIDIPARSER_HPP_
@@ -50,6 +65,41 @@
 #define DEBUG(format, ...) {}
 #endif
 
+/**
+ * Build profiles
+ * MIDI_PROFILE_COMPACT : tracks state packed into bitfields, no filters, no format 2, no voice tracker nor port router
+ * MIDI_PROFILE_TINY : compact, files up to 64KB, no after touch nor meta callbacks, file access through a MidiFileSource only
+ */
+//#define MIDI_PROFILE_COMPACT
+//#define MIDI_PROFILE_TINY
+#ifdef MIDI_PROFILE_TINY
+#define MIDI_PROFILE_COMPACT
+#define MIDI_FILE_ADDRESS_BITS 16
+#define MIDI_NO_AFTER_TOUCH_CALLBACKS
+#define MIDI_NO_META_CALLBACKS
+#define MIDI_FILE_SOURCE_ONLY
+#endif
+#ifdef MIDI_PROFILE_COMPACT
+#define MIDI_COMPACT_TRACKS
+#define MIDI_NO_FILTERS
+#define MIDI_NO_MULTIPLE_SONG
+#define MIDI_NO_EXTENSIONS
+#endif
+
+/**
+ * Define (if not allready) the number of bits of files addresses in compact tracks (24 bits = 16MB files, at most)
+ * With 16 bits or less, a compact track take 6 bytes and delta times are limited to 24 bits (16777215 ticks)
+ */
+#ifndef MIDI_FILE_ADDRESS_BITS
+#define MIDI_FILE_ADDRESS_BITS 24
+#endif
+#if MIDI_FILE_ADDRESS_BITS > 24
+#error "MIDI_FILE_ADDRESS_BITS must be 24 or less"
+#endif
+#if defined(MIDI_COMPACT_TRACKS) && MIDI_FILE_ADDRESS_BITS <= 16
+#define MIDI_SHORT_TRACKS // 6 bytes track slots
+#endif
+
 /**
  * Define (if not allready) the maximum number of midi tracks to process
  */
@@ -57,6 +107,49 @@
 #define MAX_TRACKS_NUMBERS 12
 #endif
 
+/**
+ * File source owner of the file and tracks headers reads
+ */
+#define HEADERS_OWNER MAX_TRACKS_NUMBERS
+
+/**
+ * Duration of a sequence not scanned yet
+ */
+#define SEQUENCE_NOT_SCANNED 0xFFFFFFFF
+
+/**
+ * Running status of a track before its first channel event
+ */
+#define NO_RUNNING_STATUS 0x7F
+
+class MidiFileSource;
+class MidiVoiceTable;
+class MidiPortSink;
+
+/**
+ * Decoded midi event structure
+ */
+typedef struct {
+	uint32_t time; // Absolute time in microseconds
+	uint32_t length; // Payload length of meta and sysex events
+	uint8_t track;
+	uint8_t status; // Running status resolved
+	uint8_t channel;
+	uint8_t metaType; // Meta events (status 0xFF) only
+	uint8_t data[4]; // Data bytes (short meta events payload included)
+} MidiEvent;
+
+/**
+ * Format 2 sequence index entry structure
+ */
+typedef struct {
+	uint32_t offset; // MTrk chunk address
+	uint32_t length; // Chunk data length
+	uint32_t duration; // In microseconds, SEQUENCE_NOT_SCANNED until scanSequence()
+	uint32_t nameOffset; // Track name payload address (0 if none)
+	uint8_t nameLength;
+} MidiSequence;
+
 /**
  * GenericMidiParser class
  */
@@ -67,21 +160,44 @@ private:
 	 * Midi file header structure
 	 */
 	typedef struct {
-		uint32_t headerSize; // Big endian
-		uint16_t formatType; // Big endian
-		uint16_t numberOfTracks; // Big endian
 		int16_t timeDivision;
+		uint8_t numberOfTracks; // At most MAX_TRACKS_NUMBERS
+#ifndef MIDI_NO_MULTIPLE_SONG
+		uint8_t formatType;
+#endif
 	} MidiHeader;
 
 	/**
 	 * Midi track header structure
 	 */
+#ifdef MIDI_SHORT_TRACKS
+	typedef uint16_t FileAddress;
+#pragma pack(push, 2) // 6 bytes on 32 and 64 bits hosts too
+	typedef struct {
+		uint32_t waitTime :24; // In ticks, track size is not kept
+		uint32_t runningStatus :7; // Status & 0x7F (NO_RUNNING_STATUS if none)
+		uint32_t done :1;
+		uint16_t trackPointer;
+	} TrackHeader;
+#pragma pack(pop)
+#elif defined(MIDI_COMPACT_TRACKS)
+	typedef uint32_t FileAddress;
+	typedef struct {
+		uint32_t trackPointer :MIDI_FILE_ADDRESS_BITS;
+		uint32_t runningStatus :7; // Status & 0x7F (NO_RUNNING_STATUS if none)
+		uint32_t done :1;
+		uint32_t waitTime; // In ticks, track size is not kept
+	} TrackHeader;
+#else
+	typedef uint32_t FileAddress;
 	typedef struct {
 		uint32_t trackPointer;
 		uint32_t trackSize;
-		uint32_t waitTime;
+		uint32_t waitTime; // In ticks
+		uint8_t runningStatus; // Status & 0x7F (NO_RUNNING_STATUS if none)
 		uint8_t done;
 	} TrackHeader;
+#endif
 
 public:
 
@@ -96,6 +212,22 @@ public:
 		BAD_FILE_STRUCT,
 		NO_MULTIPLE_SONG_SUPPORT,
 		NO_SMPTE_SUPPORT,
+		BAD_SEQUENCE_INDEX,
+	};
+
+	/**
+	 * Enumeration of event types filter bits
+	 */
+	enum {
+		FILTER_NOTE_OFF = 0x01,
+		FILTER_NOTE_ON = 0x02,
+		FILTER_KEY_AFTER_TOUCH = 0x04,
+		FILTER_CONTROL_CHANGE = 0x08,
+		FILTER_PATCH_CHANGE = 0x10,
+		FILTER_CHANNEL_AFTER_TOUCH = 0x20,
+		FILTER_PITCH_BEND = 0x40,
+		FILTER_SYSEX = 0x80,
+		FILTER_ALL = 0xFF
 	};
 
 	/**
@@ -124,54 +256,124 @@ public:
 private:
 	/* Misc. */
 	MidiHeader header;
+	uint8_t current_track_number;
+	volatile uint8_t paused;
+	uint16_t time_remainder; // Scheduler time fraction, in 1 / timeDivision microseconds
 	TrackHeader tracks[MAX_TRACKS_NUMBERS];
-	uint8_t current_track_number, track_finished;
 
-	volatile uint8_t paused;
-	uint8_t errno;
-	uint32_t tempo;
+	uint32_t tempo :24, errnum :8; // Midi tempos are 24 bits
+	uint32_t current_time;
+	FileAddress payload_end; // End of the last event, 0 once it is finished
+
+#ifndef MIDI_NO_MULTIPLE_SONG
+	/* Format 2 sequences */
+	MidiSequence* sequence_index;
+	uint16_t sequence_index_size, sequences_number, current_sequence;
+	uint8_t index_ready;
+#endif
+
+#ifndef MIDI_NO_FILTERS
+	/* Events filter (bit set = event accepted) */
+	uint16_t channel_filter[7]; // Channels mask for each channel event type
+	uint8_t meta_filter[16]; // 128 bits meta types mask
+	uint8_t sysex_accepted, filter_active;
+#endif
 
 	/* Low-level functions */
+#ifndef MIDI_FILE_SOURCE_ONLY
 	uint8_t (*file_read_fnct)(void);
 	void (*file_fseek_fnct)(uint32_t address);
 	uint32_t (*file_ftell_fnct)(void);
 	uint8_t (*file_eof_fnct)(void);
+#endif
 	void (*us_delay_fnct)(uint32_t us);
 	void (*assert_error_callback)(uint8_t errorCode);
+	MidiFileSource* file_source;
+#ifndef MIDI_NO_EXTENSIONS
+	MidiVoiceTable* voice_tracker;
+	MidiPortSink* port_router;
+#endif
 
 	/* Callback function */
 	void (*note_on_callback)(uint8_t channel, uint8_t key, uint8_t velocity);
 	void (*note_off_callback)(uint8_t channel, uint8_t key, uint8_t velocity);
+#ifndef MIDI_NO_AFTER_TOUCH_CALLBACKS
 	void (*key_after_touch_callback)(uint8_t channel, uint8_t key,
 			uint8_t pressure);
+	void (*channel_after_touch_callback)(uint8_t channel, uint8_t pressure);
+#endif
 	void (*control_change_callback)(uint8_t channel, uint8_t controller,
 			uint8_t data);
 	void (*patch_change_callback)(uint8_t channel, uint8_t instrument);
-	void (*channel_after_touch_callback)(uint8_t channel, uint8_t pressure);
 	void (*pitch_bend_callback)(uint8_t channel, uint16_t bend);
+#ifndef MIDI_NO_META_CALLBACKS
 	void (*meta_callback)(uint8_t metaType, uint8_t dataLength);
 	void (*meta_onChannel_prefix)(uint8_t channel);
 	void (*meta_onPort_prefix)(uint8_t channel);
 	void (*time_signature_callback)(uint8_t numerator, uint8_t denominator,
 			uint8_t metronomeTick, uint8_t note32NdNumber);
 	void (*key_signature_callback)(uint8_t sharpsFlats, uint8_t majorMinor);
+#endif
+
+	/* File access functions (through the file source if any) */
+	uint8_t fileRead();
+	void fileSeek(uint32_t address);
+	void fileSeek(uint32_t address, uint8_t owner);
+	uint32_t fileTell();
+	uint8_t fileEof();
 
 	/* Usefull functions */
 	uint8_t processHeader();
 	uint8_t processTrack();
-	void processTime();
-	uint8_t processEvent();
-	uint8_t processMeta(uint8_t cmd);
+#ifndef MIDI_NO_MULTIPLE_SONG
+	uint8_t seekSequence();
+	uint8_t walkSequences(uint16_t target);
+	uint8_t checkSequenceIndex(uint16_t index);
+#endif
+	uint8_t processTime();
+	uint8_t processEvent(MidiEvent* event);
+	uint8_t processMeta(MidiEvent* event);
+#ifndef MIDI_NO_EXTENSIONS
+	uint8_t trackVoice(const MidiEvent* event);
+	void sendNoteOff(uint8_t port, uint8_t channel, uint8_t key);
+#endif
+	uint8_t finishEvent();
+#ifndef MIDI_NO_FILTERS
+	uint8_t isTrackFiltered();
+	void updateFilterState();
+#endif
 	uint32_t readVarLenValue();
+	uint32_t readFixedValue(uint8_t len);
 	uint8_t minTime(uint32_t *min);
+	uint32_t ticksToTime(uint32_t ticks);
 
 public:
 
+#ifdef MIDI_FILE_SOURCE_ONLY
+	GenericMidiParser(MidiFileSource* file_source,
+			void (*us_delay_fnct)(uint32_t us),
+			void (*assert_error_callback)(uint8_t errorCode));
+#else
 	GenericMidiParser(uint8_t (*file_read_fnct)(void),
 			void (*file_fseek_fnct)(uint32_t address),
 			uint32_t (*file_ftell_fnct)(void), uint8_t (*file_eof_fnct)(void),
 			void (*us_delay_fnct)(uint32_t us),
 			void (*assert_error_callback)(uint8_t errorCode));
+#endif
+
+	/* File source setter function */
+
+	void setFileSource(MidiFileSource* file_source);
+
+#ifndef MIDI_NO_EXTENSIONS
+	/* Voice tracker setter function */
+
+	void setVoiceTracker(MidiVoiceTable* voice_tracker); // MidiVoiceTracker, or any MidiVoiceTable
+
+	/* Port router setter function */
+
+	void setPortRouter(MidiPortSink* port_router); // MidiPortRouter, or any MidiPortSink
+#endif
 
 	/* Callback setter functions */
 
@@ -183,10 +385,16 @@ public:
 			void (*note_off_callback)(uint8_t channel, uint8_t key,
 					uint8_t velocity));
 
+#ifndef MIDI_NO_AFTER_TOUCH_CALLBACKS
 	void setKeyAfterTouchCallback(
 			void (*key_after_touch_callback)(uint8_t channel, uint8_t key,
 					uint8_t pressure));
 
+	void setChannelAfterTouchCallback(
+			void (*channel_after_touch_callback)(uint8_t channel,
+					uint8_t pressure));
+#endif
+
 	void setControlChangeCallback(
 			void (*control_change_callback)(uint8_t channel, uint8_t controller,
 					uint8_t data));
@@ -194,13 +402,10 @@ public:
 	void setPatchChangeCallback(
 			void (*patch_change_callback)(uint8_t channel, uint8_t instrument));
 
-	void setChannelAfterTouchCallback(
-			void (*channel_after_touch_callback)(uint8_t channel,
-					uint8_t pressure));
-
 	void setPitchBendCallback(
 			void (*pitch_bend_callback)(uint8_t channel, uint16_t bend));
 
+#ifndef MIDI_NO_META_CALLBACKS
 	void setMetaCallback(
 			void (*meta_callback)(uint8_t metaType, uint8_t dataLength));
 
@@ -217,6 +422,7 @@ public:
 	void setKeySignatureCallback(
 			void (*key_signature_callback)(uint8_t sharpsFlats,
 					uint8_t majorMinor));
+#endif
 
 	/* General functions */
 
@@ -224,8 +430,69 @@ public:
 	void readBytes(uint8_t* buf, uint8_t len);
 	void dropBytes(uint8_t len);
 
+#ifndef MIDI_NO_FILTERS
+	/* Events filter functions */
+
+	void setEventFilter(uint16_t channelMask, uint8_t typeMask);
+
+	void setChannelFilter(uint16_t channelMask, uint8_t typeMask);
+
+	void setMetaFilter(uint8_t metaType, uint8_t accepted);
+
+	void clearFilters();
+#endif
+
+#ifndef MIDI_NO_MULTIPLE_SONG
+	/* Format 2 sequences functions */
+
+	void setSequenceIndex(MidiSequence* table, uint16_t size);
+
+	uint16_t getSequencesNumber() const; // 0 until load()
+
+	uint8_t selectSequence(uint16_t index);
+
+	uint8_t scanSequence(uint16_t index); // Reload the parser, the loaded song must be loaded again
+
+	uint8_t getSequenceName(uint16_t index, char* buf, uint8_t size);
+#endif
+
+	/* Events iterator */
+
+	class EventIterator {
+	private:
+		GenericMidiParser* parser;
+		MidiEvent event;
+		uint8_t timed;
+
+	public:
+		EventIterator(GenericMidiParser* parser, uint8_t timed);
+		const MidiEvent& operator*() const;
+		const MidiEvent* operator->() const;
+		EventIterator& operator++();
+		bool operator!=(const EventIterator& other) const;
+	};
+
+	class EventRange {
+	private:
+		GenericMidiParser* parser;
+		uint8_t timed;
+
+	public:
+		EventRange(GenericMidiParser* parser, uint8_t timed);
+		EventIterator begin() const;
+		EventIterator end() const;
+	};
+
 	/* Control functions */
 
+	uint8_t load();
+
+	uint8_t nextEvent(MidiEvent* event, uint8_t timed);
+
+	void dispatchEvent(const MidiEvent* event);
+
+	EventRange events(uint8_t timed = false);
+
 	void play();
 
 	void pause();
@@ -234,12 +501,16 @@ public:
 
 	void stop();
 
+	void allNotesOff();
+
 	/* Getter Setter functions */
 
 	uint8_t getErrno() const;
 
 	uint32_t getTempo() const;
 
+	uint32_t getTime() const;
+
 	void setTempo(uint32_t tempo);
 };
 
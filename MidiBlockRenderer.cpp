@@ -0,0 +1,88 @@
+/*
+ * See header file for details
+ *
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ *
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ *
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+/* Includes */
+#include "MidiBlockRenderer.hpp"
+
+MidiBlockRenderer::MidiBlockRenderer(GenericMidiParser* parser,
+		uint32_t sampleRate, uint16_t blockSize) :
+		parser(parser), sampleRate(sampleRate), blockSize(blockSize), blockStart(
+				0), hasPending(false), finished(true), lateEvents(0) {
+
+}
+
+uint64_t MidiBlockRenderer::toSamples(uint32_t us) const {
+	return ((uint64_t) us * sampleRate) / 1000000;
+}
+
+uint8_t MidiBlockRenderer::start() {
+	blockStart = 0;
+	lateEvents = 0;
+	hasPending = false;
+	finished = true;
+
+	uint8_t errnum = parser->load();
+	if (errnum)
+		return errnum;
+
+	finished = false;
+	return GenericMidiParser::NO_ERROR;
+}
+
+uint16_t MidiBlockRenderer::renderBlock(MidiBlockEvent* events,
+		uint16_t maxEvents) {
+	uint64_t blockEnd = blockStart + blockSize;
+	uint64_t sample;
+	uint16_t count = 0;
+
+	while (!finished) {
+		if (!hasPending) {
+			if (!parser->nextEvent(&pending, false)) {
+				finished = true;
+				break;
+			}
+			hasPending = true;
+		}
+
+		sample = toSamples(pending.time);
+		if (sample >= blockEnd)
+			break; // Due in a later block
+		if (count == maxEvents)
+			break; // Output buffer full, delivered next block
+
+		if (sample < blockStart)
+			lateEvents++; // Was due in a previous block
+		events[count].event = pending;
+		events[count].offset = (sample > blockStart) ? sample - blockStart : 0;
+		count++;
+		hasPending = false;
+	}
+
+	blockStart = blockEnd;
+	return count;
+}
+
+uint8_t MidiBlockRenderer::isFinished() const {
+	return finished && !hasPending;
+}
+
+uint64_t MidiBlockRenderer::getPosition() const {
+	return blockStart;
+}
+
+uint32_t MidiBlockRenderer::getLateEvents() const {
+	return lateEvents;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file MidiBlockRenderer.hpp
+ * @brief Audio block events bucketing for software synthetisers
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * This renderer pull the events of the GenericMidiParser block by block.\n
+ * Each call to renderBlock() return the events due in the next audio block,\n
+ * tagged with their exact sample offset inside the block (event times are exact to the microsecond,\n
+ * the parser carry the conversion remainder of each track).\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ *
+ * @section other_sec Others notes and compatibility warning
+ * renderBlock() never allocate memory, never lock and never wait, it can be called from the audio callback.\n
+ * But file accesses are still done inside it, so use a RAM buffer, a MidiPageCache or a MidiPrefetcher as file source.\n
+ * The payload of text, sequencer and sysex events is not available (the renderer always read one event ahead).
+ */
+
+#ifndef MIDIBLOCKRENDERER_HPP_
+#define MIDIBLOCKRENDERER_HPP_
+
+#include <stdint.h>
+#include "GenericMidiParser.hpp"
+
+/**
+ * Block event structure
+ */
+typedef struct {
+	MidiEvent event;
+	uint16_t offset; // Sample offset inside the block
+} MidiBlockEvent;
+
+/**
+ * MidiBlockRenderer class
+ */
+class MidiBlockRenderer {
+
+private:
+	GenericMidiParser* parser;
+
+	/* Audio format */
+	uint32_t sampleRate;
+	uint16_t blockSize;
+
+	/* Position */
+	uint64_t blockStart; // In samples
+	MidiEvent pending;
+	uint8_t hasPending, finished;
+
+	/* Statistics */
+	uint32_t lateEvents;
+
+	/* Usefull functions */
+	uint64_t toSamples(uint32_t us) const;
+
+public:
+
+	MidiBlockRenderer(GenericMidiParser* parser, uint32_t sampleRate,
+			uint16_t blockSize);
+
+	/* Control functions */
+
+	uint8_t start();
+
+	uint16_t renderBlock(MidiBlockEvent* events, uint16_t maxEvents);
+
+	/* Getter functions */
+
+	uint8_t isFinished() const;
+
+	uint64_t getPosition() const; // In samples
+
+	uint32_t getLateEvents() const; // Events delivered after the block they were due in
+};
+
+#endif /* MIDIBLOCKRENDERER_HPP_ */
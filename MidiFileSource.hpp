@@ -0,0 +1,54 @@
+/**
+ * @file MidiFileSource.hpp
+ * @brief File access interface between the GenericMidiParser and a cache or prefetch layer
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * When a file source is given to the parser, every file access go through it\n
+ * instead of the low-level functions. The owner argument of seek() is the track number\n
+ * (or HEADERS_OWNER, equal to MAX_TRACKS_NUMBERS, when reading the file and tracks headers).\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+
+#ifndef MIDIFILESOURCE_HPP_
+#define MIDIFILESOURCE_HPP_
+
+#include <stdint.h>
+
+/**
+ * MidiFileSource interface
+ */
+class MidiFileSource {
+
+public:
+	virtual uint8_t read() = 0;
+
+	virtual void seek(uint32_t address, uint8_t owner) = 0;
+
+	virtual uint32_t tell() const = 0;
+
+	virtual uint8_t eof() const = 0; // True once a read failed, like feof()
+
+protected:
+	~MidiFileSource() {
+	}
+};
+
+#endif /* MIDIFILESOURCE_HPP_ */
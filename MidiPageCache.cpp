@@ -0,0 +1,186 @@
+/*
+ * See header file for details
+ *
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ *
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ *
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+/* Includes */
+#include "MidiPageCache.hpp"
+#include "MidiTracer.hpp"
+
+MidiPageCache::MidiPageCache(uint8_t (*file_read_fnct)(void),
+		void (*file_fseek_fnct)(uint32_t address),
+		uint8_t (*file_eof_fnct)(void)) :
+		file_read_fnct(file_read_fnct), file_fseek_fnct(file_fseek_fnct), file_eof_fnct(
+				file_eof_fnct) {
+	invalidate();
+	resetStats();
+}
+
+void MidiPageCache::invalidate() {
+	for (uint8_t i = 0; i < PAGE_CACHE_PAGES_NUMBER; i++) {
+		headers[i].address = 0;
+		headers[i].length = 0;
+		headers[i].lastUse = 0;
+		headers[i].owner = NO_OWNER;
+	}
+	position = 0;
+	fileEnd = 0xFFFFFFFF;
+	physicalPosition = 0xFFFFFFFF; // Force a seek on first fill
+	currentPage = NO_PAGE;
+	owner = NO_OWNER;
+	useClock = 0;
+}
+
+uint8_t MidiPageCache::findPage(uint32_t address) {
+	for (uint8_t i = 0; i < PAGE_CACHE_PAGES_NUMBER; i++)
+		if (headers[i].length && address >= headers[i].address
+				&& address - headers[i].address < headers[i].length)
+			return i;
+	return NO_PAGE;
+}
+
+uint8_t MidiPageCache::evictPage(uint32_t address) {
+	uint8_t i, victim = NO_PAGE;
+	uint16_t age, oldest = 0;
+
+	for (i = 0; i < PAGE_CACHE_PAGES_NUMBER; i++)
+		if (headers[i].length == 0)
+			return i;
+
+	// Tracks are read forward, so pages left behind by the owner are dead
+	for (i = 0; i < PAGE_CACHE_PAGES_NUMBER; i++)
+		if (headers[i].owner == owner
+				&& headers[i].address + headers[i].length <= address) {
+			age = useClock - headers[i].lastUse;
+			if (victim == NO_PAGE || age >= oldest) {
+				victim = i;
+				oldest = age;
+			}
+		}
+	if (victim != NO_PAGE)
+		return victim;
+
+	// Otherwise, least recently used page
+	for (i = 0; i < PAGE_CACHE_PAGES_NUMBER; i++) {
+		age = useClock - headers[i].lastUse;
+		if (victim == NO_PAGE || age >= oldest) {
+			victim = i;
+			oldest = age;
+		}
+	}
+	return victim;
+}
+
+uint8_t MidiPageCache::fillPage(uint32_t address) {
+	uint8_t page = evictPage(address);
+	uint16_t i;
+	TRACE_BEGIN(refillStart);
+
+	if (physicalPosition != address) {
+		file_fseek_fnct(address);
+		physicalSeeks++;
+	}
+
+	for (i = 0; i < PAGE_CACHE_PAGE_SIZE; i++) {
+		if (address + i >= fileEnd)
+			break;
+		pages[page][i] = file_read_fnct();
+		if (file_eof_fnct()) { // This read failed, the byte is not part of the file
+			fileEnd = address + i;
+			break;
+		}
+	}
+
+	headers[page].address = address;
+	headers[page].length = i;
+	headers[page].owner = owner;
+	physicalPosition = address + i;
+	TRACE_END(refillStart, MidiTracer::TRACE_REFILL,
+			(owner < MAX_TRACKS_NUMBERS) ? owner : TRACE_LANE_FILE, 0, address);
+	return page;
+}
+
+uint8_t MidiPageCache::lookup() {
+	uint8_t page = findPage(position);
+
+	if (page == NO_PAGE) {
+		misses++;
+		page = fillPage(position);
+		if (headers[page].length == 0)
+			return NO_PAGE; // End of file
+	} else
+		hits++;
+
+	headers[page].lastUse = ++useClock;
+	return page;
+}
+
+uint8_t MidiPageCache::read() {
+	if (currentPage == NO_PAGE
+			|| position - headers[currentPage].address
+					>= headers[currentPage].length) {
+		currentPage = lookup();
+		if (currentPage == NO_PAGE) {
+			position++;
+			return 0;
+		}
+	}
+
+	return pages[currentPage][position++ - headers[currentPage].address];
+}
+
+void MidiPageCache::seek(uint32_t address, uint8_t owner) {
+	this->owner = owner;
+	if (currentPage != NO_PAGE && address >= headers[currentPage].address
+			&& address - headers[currentPage].address
+					< headers[currentPage].length) {
+		position = address; // Still inside the current page
+		return;
+	}
+	position = address;
+	currentPage = NO_PAGE;
+}
+
+uint32_t MidiPageCache::tell() const {
+	return position;
+}
+
+uint8_t MidiPageCache::eof() const {
+	return position > fileEnd; // Like feof(), only once a read went past the end
+}
+
+uint32_t MidiPageCache::getHits() const {
+	return hits;
+}
+
+uint32_t MidiPageCache::getMisses() const {
+	return misses;
+}
+
+uint32_t MidiPageCache::getPhysicalSeeks() const {
+	return physicalSeeks;
+}
+
+uint8_t MidiPageCache::getHitRate() const {
+	uint32_t total = hits + misses;
+	if (total == 0)
+		return 0;
+	return (uint8_t) ((hits * 100ULL) / total);
+}
+
+void MidiPageCache::resetStats() {
+	hits = 0;
+	misses = 0;
+	physicalSeeks = 0;
+}
@@ -0,0 +1,136 @@
+/**
+ * @file MidiPageCache.hpp
+ * @brief Fixed footprint RAM page cache for the GenericMidiParser
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * This cache sit between the midi parser and the low-level file functions.\n
+ * Each page is a window of the file owned by one track, filled in one sequential burst.\n
+ * All the storage is static (no heap), the footprint is PAGE_CACHE_PAGE_SIZE * PAGE_CACHE_PAGES_NUMBER bytes plus headers.\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ *
+ * @section other_sec Others notes and compatibility warning
+ * Pages are not aligned, a page always start at the address which missed.\n
+ * So a refill load only bytes ahead of the track cursor (tracks are read sequentially).\n
+ * file_eof_fnct() is checked after each read, it must return true once a read failed (like feof()),\n
+ * not once the last byte was read (on arduino, keep the failure of File.read() instead of testing available()).
+ */
+
+#ifndef MIDIPAGECACHE_HPP_
+#define MIDIPAGECACHE_HPP_
+
+#include <stdint.h>
+#include "MidiFileSource.hpp"
+
+/**
+ * Define (if not allready) the size in bytes of one cache page
+ */
+#ifndef PAGE_CACHE_PAGE_SIZE
+#define PAGE_CACHE_PAGE_SIZE 128
+#endif
+
+/**
+ * Define (if not allready) the number of cache pages
+ */
+#ifndef PAGE_CACHE_PAGES_NUMBER
+#define PAGE_CACHE_PAGES_NUMBER 16
+#endif
+
+/**
+ * MidiPageCache class
+ */
+class MidiPageCache: public MidiFileSource {
+
+private:
+	/**
+	 * Cache page header structure
+	 */
+	typedef struct {
+		uint32_t address;
+		uint16_t length;
+		uint16_t lastUse;
+		uint8_t owner;
+	} PageHeader;
+
+public:
+
+	/**
+	 * Special values
+	 */
+	enum {
+		NO_OWNER = 0xFF, NO_PAGE = 0xFF,
+	};
+
+private:
+	/* Storage */
+	uint8_t pages[PAGE_CACHE_PAGES_NUMBER][PAGE_CACHE_PAGE_SIZE];
+	PageHeader headers[PAGE_CACHE_PAGES_NUMBER];
+
+	/* Cursor */
+	uint32_t position, fileEnd, physicalPosition;
+	uint8_t currentPage, owner;
+	uint16_t useClock;
+
+	/* Statistics */
+	uint32_t hits, misses, physicalSeeks;
+
+	/* Low-level functions */
+	uint8_t (*file_read_fnct)(void);
+	void (*file_fseek_fnct)(uint32_t address);
+	uint8_t (*file_eof_fnct)(void);
+
+	/* Usefull functions */
+	uint8_t findPage(uint32_t address);
+	uint8_t evictPage(uint32_t address);
+	uint8_t fillPage(uint32_t address);
+	uint8_t lookup();
+
+public:
+
+	MidiPageCache(uint8_t (*file_read_fnct)(void),
+			void (*file_fseek_fnct)(uint32_t address),
+			uint8_t (*file_eof_fnct)(void));
+
+	/* General functions */
+
+	void invalidate();
+
+	uint8_t read();
+
+	void seek(uint32_t address, uint8_t owner);
+
+	uint32_t tell() const;
+
+	uint8_t eof() const;
+
+	/* Statistics functions */
+
+	uint32_t getHits() const;
+
+	uint32_t getMisses() const;
+
+	uint32_t getPhysicalSeeks() const;
+
+	uint8_t getHitRate() const; // In percent
+
+	void resetStats();
+};
+
+#endif /* MIDIPAGECACHE_HPP_ */
@@ -0,0 +1,169 @@
+/*
+ * See header file for details
+ *
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ *
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ *
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+/* Includes */
+#include "MidiPlaylist.hpp"
+#include "MidiTracer.hpp"
+
+MidiPlaylist::MidiPlaylist(GenericMidiParser* first, GenericMidiParser* second,
+		uint8_t (*open_song_fnct)(uint8_t slot, uint16_t song),
+		void (*us_delay_fnct)(uint32_t us), uint32_t (*us_clock_fnct)(void)) :
+		current(0), mode(PLAYLIST_CARRY_STATE), nextSong(0), currentSong(0), stopped(
+				false), preloadTime(0), open_song_fnct(open_song_fnct), us_delay_fnct(
+				us_delay_fnct), us_clock_fnct(us_clock_fnct) {
+	slots[0].parser = first;
+	slots[1].parser = second;
+	slots[0].state = SLOT_EMPTY;
+	slots[1].state = SLOT_EMPTY;
+}
+
+MidiPlaylist::~MidiPlaylist() {
+#ifdef PLAYLIST_PRELOAD_THREAD
+	if (loader.joinable())
+		loader.join();
+#endif
+}
+
+void MidiPlaylist::setStateMode(uint8_t mode) {
+	this->mode = mode;
+}
+
+void MidiPlaylist::preload(uint8_t slot) {
+	Slot& s = slots[slot];
+	uint32_t start = us_clock_fnct ? us_clock_fnct() : 0;
+
+	// Songs without any event (or broken) are skipped
+	for (;;) {
+		s.song = nextSong++;
+		if (!open_song_fnct(slot, s.song)) {
+			s.state = SLOT_END;
+			break;
+		}
+		if (!s.parser->load() && s.parser->nextEvent(&s.first, false)) {
+			s.state = SLOT_READY;
+			break;
+		}
+	}
+
+	if (us_clock_fnct)
+		preloadTime = us_clock_fnct() - start;
+}
+
+void MidiPlaylist::startPreload(uint8_t slot) {
+	slots[slot].state = SLOT_LOADING;
+#ifdef PLAYLIST_PRELOAD_THREAD
+	loader = std::thread(&MidiPlaylist::preload, this, slot);
+#endif
+}
+
+void MidiPlaylist::finishPreload(uint8_t slot) {
+#ifdef PLAYLIST_PRELOAD_THREAD
+	if (loader.joinable())
+		loader.join();
+#endif
+	if (slots[slot].state == SLOT_LOADING) // No idle time long enough
+		preload(slot);
+}
+
+void MidiPlaylist::wait(uint32_t us) {
+	uint8_t next = current ^ 1;
+
+#ifndef PLAYLIST_PRELOAD_THREAD
+	if (slots[next].state == SLOT_LOADING && us >= PLAYLIST_IDLE_MIN_WAIT) {
+		preload(next);
+		if (preloadTime >= us)
+			return;
+		us -= preloadTime;
+	}
+#else
+	(void) next;
+#endif
+
+	if (us)
+		us_delay_fnct(us);
+}
+
+void MidiPlaylist::resetControllers(GenericMidiParser* parser,
+		uint32_t time) {
+	MidiEvent event;
+
+	event.time = time;
+	event.length = 0;
+	event.track = 0;
+	event.metaType = 0;
+	event.data[0] = 121; // Reset all controllers
+	event.data[1] = 0;
+	for (uint8_t channel = 0; channel < 16; channel++) {
+		event.status = 0xB0 | channel;
+		event.channel = channel;
+		parser->dispatchEvent(&event);
+	}
+}
+
+void MidiPlaylist::play(uint16_t firstSong) {
+	MidiEvent event;
+	uint32_t lastTime;
+
+	stopped = false;
+	nextSong = firstSong;
+	current = 0;
+	preload(current);
+
+	while (slots[current].state == SLOT_READY && !stopped) {
+		GenericMidiParser* parser = slots[current].parser;
+		event = slots[current].first;
+		currentSong = slots[current].song;
+		slots[current].state = SLOT_EMPTY;
+		TRACE_SONG_START(); // Hand over, the song was loaded while the previous one played
+		startPreload(current ^ 1);
+
+		DEBUG("Playlist: song %d", currentSong);
+		lastTime = 0;
+		do {
+			TRACE_BEGIN(waitStart);
+			wait(event.time - lastTime);
+			TRACE_END(waitStart, MidiTracer::TRACE_WAIT, TRACE_LANE_SCHEDULER,
+					0, event.time - lastTime);
+			lastTime = event.time;
+			TRACE_BEGIN(dispatchStart);
+			parser->dispatchEvent(&event);
+			TRACE_END(dispatchStart, MidiTracer::TRACE_CALLBACK, event.track,
+					event.status, event.time);
+		} while (!stopped && parser->nextEvent(&event, false));
+
+		// Hand over at the end of track time, the next song first event is already decoded
+		parser->allNotesOff();
+		finishPreload(current ^ 1);
+		if (mode == PLAYLIST_RESET_STATE)
+			resetControllers(parser, lastTime);
+		current ^= 1;
+	}
+
+	slots[0].state = SLOT_EMPTY;
+	slots[1].state = SLOT_EMPTY;
+}
+
+void MidiPlaylist::stop() {
+	stopped = true;
+}
+
+uint16_t MidiPlaylist::getCurrentSong() const {
+	return currentSong;
+}
+
+uint32_t MidiPlaylist::getPreloadTime() const {
+	return preloadTime;
+}
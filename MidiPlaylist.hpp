@@ -0,0 +1,137 @@
+/**
+ * @file MidiPlaylist.hpp
+ * @brief Gapless playlist player for the GenericMidiParser
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * The playlist play songs back to back using two parsers (slots).\n
+ * While one slot play song N, the other one open song N + 1, parse its header and tracks table\n
+ * and decode its first event, so the next song start exactly at the end of track time.\n
+ * Controllers state can be carried across songs or reset (reset all controllers on every channels).\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ *
+ * @section other_sec Others notes and compatibility warning
+ * Each slot parser must read its own file (own low-level functions or file source),\n
+ * the open song function open the requested song on the file of the given slot.\n
+ * By default the next song is preloaded in idle time, during the first wait longer than PLAYLIST_IDLE_MIN_WAIT\n
+ * (the preload time is taken from the wait when a clock function is given).\n
+ * On PC, define PLAYLIST_PRELOAD_THREAD to preload from a background thread instead\n
+ * (the tracer must not be attached in this case).
+ */
+
+#ifndef MIDIPLAYLIST_HPP_
+#define MIDIPLAYLIST_HPP_
+
+#include <stdint.h>
+#include "GenericMidiParser.hpp"
+
+#ifdef PLAYLIST_PRELOAD_THREAD
+#include <thread>
+#endif
+
+/**
+ * Define (if not allready) the minimum wait in microseconds used to preload in idle time
+ */
+#ifndef PLAYLIST_IDLE_MIN_WAIT
+#define PLAYLIST_IDLE_MIN_WAIT 5000
+#endif
+
+/**
+ * MidiPlaylist class
+ */
+class MidiPlaylist {
+
+public:
+
+	/**
+	 * Enumeration of controllers state modes
+	 */
+	enum {
+		PLAYLIST_CARRY_STATE, PLAYLIST_RESET_STATE,
+	};
+
+private:
+	/**
+	 * Parser slot structure
+	 */
+	typedef struct {
+		GenericMidiParser* parser;
+		MidiEvent first; // First event, decoded by the preload
+		uint16_t song;
+		uint8_t state;
+	} Slot;
+
+	/**
+	 * Enumeration of slot states
+	 */
+	enum {
+		SLOT_EMPTY, SLOT_LOADING, SLOT_READY, SLOT_END,
+	};
+
+	/* Slots */
+	Slot slots[2];
+	uint8_t current, mode;
+	uint16_t nextSong, currentSong;
+	volatile uint8_t stopped;
+#ifdef PLAYLIST_PRELOAD_THREAD
+	std::thread loader;
+#endif
+
+	/* Statistics */
+	uint32_t preloadTime;
+
+	/* Low-level functions */
+	uint8_t (*open_song_fnct)(uint8_t slot, uint16_t song);
+	void (*us_delay_fnct)(uint32_t us);
+	uint32_t (*us_clock_fnct)(void);
+
+	/* Usefull functions */
+	void preload(uint8_t slot);
+	void startPreload(uint8_t slot);
+	void finishPreload(uint8_t slot);
+	void wait(uint32_t us);
+	void resetControllers(GenericMidiParser* parser, uint32_t time);
+
+public:
+
+	MidiPlaylist(GenericMidiParser* first, GenericMidiParser* second,
+			uint8_t (*open_song_fnct)(uint8_t slot, uint16_t song),
+			void (*us_delay_fnct)(uint32_t us), uint32_t (*us_clock_fnct)(void));
+
+	~MidiPlaylist();
+
+	/* Configuration functions */
+
+	void setStateMode(uint8_t mode);
+
+	/* Control functions */
+
+	void play(uint16_t firstSong = 0);
+
+	void stop();
+
+	/* Getter functions */
+
+	uint16_t getCurrentSong() const;
+
+	uint32_t getPreloadTime() const; // Last preload, in microseconds (0 without clock)
+};
+
+#endif /* MIDIPLAYLIST_HPP_ */
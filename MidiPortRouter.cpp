@@ -0,0 +1,165 @@
+/*
+ * See header file for details
+ *
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ *
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ *
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+/* Includes */
+#include "MidiPortRouter.hpp"
+
+#define QUEUE_MASK (ROUTER_QUEUE_SIZE - 1)
+
+MidiPortRouter::MidiPortRouter(uint32_t (*us_clock_fnct)(void)) :
+		us_clock_fnct(us_clock_fnct) {
+	for (uint8_t i = 0; i < ROUTER_PORTS_NUMBER; i++)
+		ports[i].writer = 0;
+	reset();
+}
+
+void MidiPortRouter::setWriter(uint8_t port,
+		void (*writer)(const uint8_t* data, uint8_t length)) {
+	ports[port % ROUTER_PORTS_NUMBER].writer = writer;
+}
+
+void MidiPortRouter::setTrackPort(uint8_t track, uint8_t port) {
+	if (track < MAX_TRACKS_NUMBERS)
+		trackPort[track] = port % ROUTER_PORTS_NUMBER;
+}
+
+uint8_t MidiPortRouter::getTrackPort(uint8_t track) const {
+	return trackPort[track % MAX_TRACKS_NUMBERS];
+}
+
+void MidiPortRouter::reset() {
+	uint8_t i;
+	for (i = 0; i < ROUTER_PORTS_NUMBER; i++) {
+		ports[i].head = 0;
+		ports[i].tail = 0;
+	}
+	for (i = 0; i < MAX_TRACKS_NUMBERS; i++)
+		trackPort[i] = 0;
+	resetStats();
+}
+
+uint8_t MidiPortRouter::push(uint8_t port, const uint8_t* data,
+		uint8_t length) {
+	Port& p = ports[port % ROUTER_PORTS_NUMBER];
+	uint8_t head = p.head;
+	uint8_t backlog = head - __atomic_load_n(&p.tail, __ATOMIC_ACQUIRE);
+
+	if (backlog >= ROUTER_QUEUE_SIZE) {
+		p.dropped++;
+		return false;
+	}
+
+	Message& message = p.queue[head & QUEUE_MASK];
+	message.time = us_clock_fnct ? us_clock_fnct() : 0;
+	message.length = length;
+	for (uint8_t i = 0; i < length; i++)
+		message.data[i] = data[i];
+	__atomic_store_n(&p.head, (uint8_t) (head + 1), __ATOMIC_RELEASE);
+
+	if (backlog + 1 > p.maxBacklog)
+		p.maxBacklog = backlog + 1;
+	return true;
+}
+
+void MidiPortRouter::route(const MidiEvent* event) {
+	uint8_t data[3];
+
+	if (event->status == 0xFF && event->metaType == 0x21) { // Port prefix
+		setTrackPort(event->track, event->data[0]);
+		return;
+	}
+	if (event->status >= 0xF0)
+		return; // Not a channel event
+
+	data[0] = event->status;
+	data[1] = event->data[0];
+	data[2] = event->data[1];
+	push(getTrackPort(event->track), data,
+			((event->status >> 4) == 0x0C || (event->status >> 4) == 0x0D) ?
+					2 : 3);
+}
+
+void MidiPortRouter::broadcast(const uint8_t* data, uint8_t length) {
+	for (uint8_t i = 0; i < ROUTER_PORTS_NUMBER; i++)
+		push(i, data, length);
+}
+
+uint8_t MidiPortRouter::drain(uint8_t port, uint8_t maxMessages) {
+	Port& p = ports[port % ROUTER_PORTS_NUMBER];
+	uint8_t count = 0;
+	uint32_t latency;
+
+	while (count < maxMessages) {
+		uint8_t tail = p.tail;
+		if (tail == __atomic_load_n(&p.head, __ATOMIC_ACQUIRE))
+			break; // Empty
+
+		Message& message = p.queue[tail & QUEUE_MASK];
+		if (us_clock_fnct) {
+			latency = us_clock_fnct() - message.time;
+			p.totalLatency += latency;
+			if (latency > p.maxLatency)
+				p.maxLatency = latency;
+		}
+		if (p.writer)
+			p.writer(message.data, message.length);
+
+		__atomic_store_n(&p.tail, (uint8_t) (tail + 1), __ATOMIC_RELEASE);
+		p.sent++;
+		count++;
+	}
+
+	return count;
+}
+
+uint8_t MidiPortRouter::getBacklog(uint8_t port) const {
+	const Port& p = ports[port % ROUTER_PORTS_NUMBER];
+	return __atomic_load_n(&p.head, __ATOMIC_ACQUIRE)
+			- __atomic_load_n(&p.tail, __ATOMIC_ACQUIRE);
+}
+
+uint8_t MidiPortRouter::getMaxBacklog(uint8_t port) const {
+	return ports[port % ROUTER_PORTS_NUMBER].maxBacklog;
+}
+
+uint32_t MidiPortRouter::getSent(uint8_t port) const {
+	return ports[port % ROUTER_PORTS_NUMBER].sent;
+}
+
+uint32_t MidiPortRouter::getDropped(uint8_t port) const {
+	return ports[port % ROUTER_PORTS_NUMBER].dropped;
+}
+
+uint32_t MidiPortRouter::getMaxLatency(uint8_t port) const {
+	return ports[port % ROUTER_PORTS_NUMBER].maxLatency;
+}
+
+uint32_t MidiPortRouter::getAverageLatency(uint8_t port) const {
+	const Port& p = ports[port % ROUTER_PORTS_NUMBER];
+	if (p.sent == 0)
+		return 0;
+	return p.totalLatency / p.sent;
+}
+
+void MidiPortRouter::resetStats() {
+	for (uint8_t i = 0; i < ROUTER_PORTS_NUMBER; i++) {
+		ports[i].sent = 0;
+		ports[i].dropped = 0;
+		ports[i].maxLatency = 0;
+		ports[i].totalLatency = 0;
+		ports[i].maxBacklog = 0;
+	}
+}
@@ -0,0 +1,137 @@
+/**
+ * @file MidiPortRouter.hpp
+ * @brief Multi-port output routing with per-port queues for the GenericMidiParser
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * Channel events are encoded as raw midi messages and pushed to the queue of their track's port.\n
+ * The port of a track is set with setTrackPort() or by a midi port prefix meta event (0x21).\n
+ * Each queue is drained by its own writer, so a slow port never block the parser nor the other ports.\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ *
+ * @section other_sec Others notes and compatibility warning
+ * Each queue is single producer (the parser) single consumer (the port writer) and lock free,\n
+ * drain() can be called from another thread, from an interrupt or from the us_delay_fnct.\n
+ * When a queue is full the new message is dropped and counted.\n
+ * ROUTER_QUEUE_SIZE must be a power of two, 128 at most.
+ */
+
+#ifndef MIDIPORTROUTER_HPP_
+#define MIDIPORTROUTER_HPP_
+
+#include <stdint.h>
+#include "GenericMidiParser.hpp"
+#include "MidiPortSink.hpp"
+
+/**
+ * Define (if not allready) the number of output ports
+ */
+#ifndef ROUTER_PORTS_NUMBER
+#define ROUTER_PORTS_NUMBER 4
+#endif
+
+/**
+ * Define (if not allready) the number of messages per port queue
+ */
+#ifndef ROUTER_QUEUE_SIZE
+#define ROUTER_QUEUE_SIZE 32
+#endif
+
+/**
+ * MidiPortRouter class
+ */
+class MidiPortRouter: public MidiPortSink {
+
+private:
+	/**
+	 * Queued midi message structure
+	 */
+	typedef struct {
+		uint32_t time; // Enqueue time in microseconds
+		uint8_t length;
+		uint8_t data[3];
+	} Message;
+
+	/**
+	 * Output port structure
+	 */
+	typedef struct {
+		Message queue[ROUTER_QUEUE_SIZE];
+		uint8_t head, tail; // Free running indexes
+		void (*writer)(const uint8_t* data, uint8_t length);
+
+		/* Statistics */
+		uint32_t sent, dropped, maxLatency;
+		uint64_t totalLatency;
+		uint8_t maxBacklog;
+	} Port;
+
+	/* Ports */
+	Port ports[ROUTER_PORTS_NUMBER];
+	uint8_t trackPort[MAX_TRACKS_NUMBERS];
+
+	/* Low-level functions */
+	uint32_t (*us_clock_fnct)(void);
+
+public:
+
+	MidiPortRouter(uint32_t (*us_clock_fnct)(void));
+
+	/* Configuration functions */
+
+	void setWriter(uint8_t port,
+			void (*writer)(const uint8_t* data, uint8_t length));
+
+	void setTrackPort(uint8_t track, uint8_t port);
+
+	uint8_t getTrackPort(uint8_t track) const;
+
+	void reset();
+
+	/* Producer functions (parser side) */
+
+	uint8_t push(uint8_t port, const uint8_t* data, uint8_t length);
+
+	void route(const MidiEvent* event);
+
+	void broadcast(const uint8_t* data, uint8_t length);
+
+	/* Consumer functions (writer side) */
+
+	uint8_t drain(uint8_t port, uint8_t maxMessages);
+
+	/* Statistics functions */
+
+	uint8_t getBacklog(uint8_t port) const;
+
+	uint8_t getMaxBacklog(uint8_t port) const;
+
+	uint32_t getSent(uint8_t port) const;
+
+	uint32_t getDropped(uint8_t port) const;
+
+	uint32_t getMaxLatency(uint8_t port) const; // In microseconds
+
+	uint32_t getAverageLatency(uint8_t port) const; // In microseconds
+
+	void resetStats();
+};
+
+#endif /* MIDIPORTROUTER_HPP_ */
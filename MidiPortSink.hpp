@@ -0,0 +1,54 @@
+/**
+ * @file MidiPortSink.hpp
+ * @brief Output ports interface between the GenericMidiParser and a port router
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * When a port sink is given to the parser, every dispatched event is routed to it,\n
+ * and the note off of released voices are pushed to the port their note sound on.\n
+ * The parser only call it through this interface, so programs which do not use a port router\n
+ * do not have to build nor link MidiPortRouter.cpp.\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+
+#ifndef MIDIPORTSINK_HPP_
+#define MIDIPORTSINK_HPP_
+
+#include <stdint.h>
+#include "GenericMidiParser.hpp" // MidiEvent
+
+/**
+ * MidiPortSink interface
+ */
+class MidiPortSink {
+
+public:
+	virtual uint8_t getTrackPort(uint8_t track) const = 0;
+
+	virtual uint8_t push(uint8_t port, const uint8_t* data, uint8_t length) = 0;
+
+	virtual void route(const MidiEvent* event) = 0;
+
+protected:
+	~MidiPortSink() {
+	}
+};
+
+#endif /* MIDIPORTSINK_HPP_ */
@@ -0,0 +1,299 @@
+/*
+ * See header file for details
+ *
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ *
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ *
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+#ifndef ARDUINO // PC only, see header file
+
+/* Includes */
+#include <chrono>
+#include "MidiPrefetcher.hpp"
+#include "MidiTracer.hpp"
+
+#define NO_BUFFER 0xFF
+
+MidiPrefetcher::MidiPrefetcher(uint8_t (*file_read_fnct)(void),
+		void (*file_fseek_fnct)(uint32_t address),
+		uint8_t (*file_eof_fnct)(void)) :
+		current(0), position(0), window(0), windowAddress(0), windowLength(
+				0), fileEnd(0xFFFFFFFF), running(false), policy(
+				PREFETCH_WAIT), roundRobin(0), file_read_fnct(file_read_fnct), file_fseek_fnct(
+				file_fseek_fnct), file_eof_fnct(file_eof_fnct) {
+	for (uint8_t i = 0; i <= MAX_TRACKS_NUMBERS; i++) {
+		streams[i].buffers[0].state = BUFFER_FREE;
+		streams[i].buffers[1].state = BUFFER_FREE;
+		streams[i].nextAddress = 0;
+		streams[i].generation = 0;
+		streams[i].front = 0;
+		streams[i].active = false;
+	}
+	resetStats();
+}
+
+MidiPrefetcher::~MidiPrefetcher() {
+	stop();
+}
+
+void MidiPrefetcher::start() {
+	if (running)
+		return;
+	running = true;
+	worker = std::thread(&MidiPrefetcher::run, this);
+}
+
+void MidiPrefetcher::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!running)
+			return;
+		running = false;
+	}
+	wakeWorker.notify_all();
+	bufferReady.notify_all();
+	worker.join();
+}
+
+void MidiPrefetcher::setUnderrunPolicy(uint8_t policy) {
+	this->policy = policy;
+}
+
+uint32_t MidiPrefetcher::fillBuffer(uint8_t* data, uint32_t address) {
+	std::lock_guard<std::mutex> guard(io_lock);
+	uint32_t i, end = fileEnd;
+
+	if (address >= end)
+		return 0;
+
+	file_fseek_fnct(address);
+	for (i = 0; i < PREFETCH_BUFFER_SIZE; i++) {
+		if (address + i >= end || file_eof_fnct()) {
+			if (address + i < end)
+				fileEnd = address + i;
+			break;
+		}
+		data[i] = file_read_fnct();
+	}
+	return i;
+}
+
+uint8_t MidiPrefetcher::pickJob(uint8_t* stream, uint8_t* buffer) {
+	uint8_t i, j, pass, s;
+
+	// First pass serve starving streams (nothing ready), second pass read ahead
+	for (pass = 0; pass < 2; pass++)
+		for (i = 0; i <= MAX_TRACKS_NUMBERS; i++) {
+			s = (roundRobin + i) % (MAX_TRACKS_NUMBERS + 1);
+			Stream& st = streams[s];
+			if (!st.active)
+				continue;
+			if (pass == 0
+					&& (st.buffers[0].state != BUFFER_FREE
+							|| st.buffers[1].state != BUFFER_FREE))
+				continue;
+			for (j = 0; j < 2; j++)
+				if (st.buffers[j].state == BUFFER_FREE) {
+					roundRobin = s + 1;
+					*stream = s;
+					*buffer = j;
+					return true;
+				}
+		}
+
+	return false;
+}
+
+void MidiPrefetcher::run() {
+	std::unique_lock<std::mutex> guard(lock);
+	uint8_t s, b;
+
+	while (running) {
+		if (!pickJob(&s, &b)) {
+			wakeWorker.wait(guard);
+			continue;
+		}
+
+		Stream& stream = streams[s];
+		Buffer& buffer = stream.buffers[b];
+		buffer.state = BUFFER_FILLING;
+		buffer.generation = stream.generation;
+		buffer.address = stream.nextAddress;
+		stream.nextAddress += PREFETCH_BUFFER_SIZE;
+
+		guard.unlock();
+		uint32_t length = fillBuffer(buffer.data, buffer.address);
+		guard.lock();
+
+		fills++;
+		buffer.length = length;
+		if (buffer.generation == stream.generation)
+			buffer.state = BUFFER_READY;
+		else
+			buffer.state = BUFFER_FREE; // Track jumped meanwhile, drop it
+		bufferReady.notify_all();
+	}
+}
+
+uint8_t MidiPrefetcher::findBuffer(Stream& stream, uint32_t address) {
+	for (uint8_t i = 0; i < 2; i++) {
+		Buffer& buffer = stream.buffers[i];
+		if (buffer.state != BUFFER_READY
+				|| buffer.generation != stream.generation)
+			continue;
+		if (address >= buffer.address
+				&& (address - buffer.address < buffer.length
+						|| (buffer.length == 0 && address == buffer.address)))
+			return i;
+	}
+	return NO_BUFFER;
+}
+
+void MidiPrefetcher::reposition(Stream& stream, uint32_t address) {
+	stream.generation++;
+	for (uint8_t i = 0; i < 2; i++)
+		if (stream.buffers[i].state == BUFFER_READY)
+			stream.buffers[i].state = BUFFER_FREE;
+	stream.nextAddress = address;
+	stream.active = true;
+}
+
+uint8_t MidiPrefetcher::acquire() {
+	Stream& stream = streams[current];
+	std::unique_lock<std::mutex> guard(lock);
+	uint8_t i, found, pending, counted = false;
+	TRACE_BEGIN(underrunStart);
+
+	for (;;) {
+		found = findBuffer(stream, position);
+		if (found != NO_BUFFER) {
+			// Give the buffers left behind the cursor back to the worker
+			for (i = 0; i < 2; i++) {
+				Buffer& buffer = stream.buffers[i];
+				if (i != found && buffer.state == BUFFER_READY
+						&& buffer.address + buffer.length <= position) {
+					buffer.state = BUFFER_FREE;
+					wakeWorker.notify_one();
+				}
+			}
+			window = stream.buffers[found].data;
+			windowAddress = stream.buffers[found].address;
+			windowLength = stream.buffers[found].length;
+			if (counted)
+				TRACE_END(underrunStart, MidiTracer::TRACE_UNDERRUN,
+						(current < MAX_TRACKS_NUMBERS) ? current : TRACE_LANE_FILE,
+						0, position);
+			return windowLength != 0;
+		}
+
+		// Prefetch fall behind (or the track jumped)
+		if (!counted) {
+			underruns++;
+			counted = true;
+		}
+
+		pending = false;
+		for (i = 0; i < 2; i++) {
+			Buffer& buffer = stream.buffers[i];
+			if (buffer.state == BUFFER_READY)
+				buffer.state = BUFFER_FREE;
+			else if (buffer.state == BUFFER_FILLING
+					&& buffer.generation == stream.generation
+					&& position >= buffer.address
+					&& position - buffer.address < PREFETCH_BUFFER_SIZE)
+				pending = true;
+		}
+		if (!pending && (!stream.active || stream.nextAddress != position))
+			reposition(stream, position);
+
+		if (!pending && (policy == PREFETCH_SYNC_READ || !running)) {
+			for (i = 0; i < 2; i++)
+				if (stream.buffers[i].state == BUFFER_FREE)
+					break;
+			if (i < 2) {
+				Buffer& buffer = stream.buffers[i];
+				buffer.state = BUFFER_FILLING;
+				buffer.generation = stream.generation;
+				buffer.address = position;
+				stream.nextAddress = position + PREFETCH_BUFFER_SIZE;
+
+				guard.unlock();
+				uint32_t length = fillBuffer(buffer.data, buffer.address);
+				guard.lock();
+
+				syncReads++;
+				buffer.length = length;
+				buffer.state = BUFFER_READY;
+				wakeWorker.notify_one();
+				continue;
+			}
+		}
+
+		wakeWorker.notify_one();
+		std::chrono::steady_clock::time_point begin =
+				std::chrono::steady_clock::now();
+		bufferReady.wait(guard);
+		stallUs += std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - begin).count();
+	}
+}
+
+uint8_t MidiPrefetcher::read() {
+	if (position - windowAddress >= windowLength && !acquire()) {
+		position++;
+		return 0; // End of file
+	}
+	return window[position++ - windowAddress];
+}
+
+void MidiPrefetcher::seek(uint32_t address, uint8_t owner) {
+	uint8_t stream = (owner < MAX_TRACKS_NUMBERS) ? owner : MAX_TRACKS_NUMBERS;
+	position = address;
+
+	if (stream != current) {
+		current = stream;
+		windowLength = 0;
+	}
+}
+
+uint32_t MidiPrefetcher::tell() const {
+	return position;
+}
+
+uint8_t MidiPrefetcher::eof() const {
+	return position > fileEnd; // Like feof(), only once a read went past the end
+}
+
+uint32_t MidiPrefetcher::getFills() const {
+	return fills;
+}
+
+uint32_t MidiPrefetcher::getUnderruns() const {
+	return underruns;
+}
+
+uint32_t MidiPrefetcher::getSyncReads() const {
+	return syncReads;
+}
+
+uint32_t MidiPrefetcher::getStallTime() const {
+	return stallUs;
+}
+
+void MidiPrefetcher::resetStats() {
+	fills = 0;
+	underruns = 0;
+	syncReads = 0;
+	stallUs = 0;
+}
+
+#endif /* ARDUINO */
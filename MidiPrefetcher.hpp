@@ -0,0 +1,170 @@
+/**
+ * @file MidiPrefetcher.hpp
+ * @brief Asynchronous double buffered prefetch layer for the GenericMidiParser (PC only)
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * A background thread keep the next PREFETCH_BUFFER_SIZE * 2 bytes of each track resident.\n
+ * Each track own two buffers : the playback thread read the front one while the worker fill the back one.\n
+ * The playback thread only touch the low-level functions when the prefetch fall behind and\n
+ * the underrun policy is PREFETCH_SYNC_READ.\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ *
+ * @section other_sec Others notes and compatibility warning
+ * This layer require C++11 threads, it is not designed for micro-controllers (use MidiPageCache instead).\n
+ * The low-level functions are only called with an internal lock held, so they do not need to be thread safe.
+ */
+
+#ifndef MIDIPREFETCHER_HPP_
+#define MIDIPREFETCHER_HPP_
+
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "MidiFileSource.hpp"
+#include "GenericMidiParser.hpp" // MAX_TRACKS_NUMBERS
+
+/**
+ * Define (if not allready) the size in bytes of one prefetch buffer
+ */
+#ifndef PREFETCH_BUFFER_SIZE
+#define PREFETCH_BUFFER_SIZE 4096
+#endif
+
+/**
+ * MidiPrefetcher class
+ */
+class MidiPrefetcher: public MidiFileSource {
+
+private:
+	/**
+	 * Prefetch buffer structure
+	 */
+	typedef struct {
+		uint8_t data[PREFETCH_BUFFER_SIZE];
+		uint32_t address;
+		uint32_t length;
+		uint32_t generation;
+		uint8_t state;
+	} Buffer;
+
+	/**
+	 * Per track double buffer structure
+	 */
+	typedef struct {
+		Buffer buffers[2];
+		uint32_t nextAddress;
+		uint32_t generation;
+		uint8_t front;
+		uint8_t active;
+	} Stream;
+
+	/**
+	 * Enumeration of buffer states
+	 */
+	enum {
+		BUFFER_FREE, BUFFER_FILLING, BUFFER_READY,
+	};
+
+public:
+
+	/**
+	 * Enumeration of underrun policies
+	 */
+	enum {
+		PREFETCH_WAIT, // Block until the worker deliver the buffer
+		PREFETCH_SYNC_READ, // Read the buffer from the playback thread
+	};
+
+private:
+	/* Streams (one per track, plus one for the file headers) */
+	Stream streams[MAX_TRACKS_NUMBERS + 1];
+	uint8_t current;
+	uint32_t position;
+
+	/* Front buffer window (playback thread only) */
+	const uint8_t* window;
+	uint32_t windowAddress, windowLength;
+	std::atomic<uint32_t> fileEnd;
+
+	/* Worker */
+	std::thread worker;
+	std::mutex lock, io_lock;
+	std::condition_variable wakeWorker, bufferReady;
+	uint8_t running, policy, roundRobin;
+
+	/* Statistics */
+	std::atomic<uint32_t> fills, underruns, syncReads, stallUs;
+
+	/* Low-level functions */
+	uint8_t (*file_read_fnct)(void);
+	void (*file_fseek_fnct)(uint32_t address);
+	uint8_t (*file_eof_fnct)(void);
+
+	/* Usefull functions */
+	void run();
+	uint32_t fillBuffer(uint8_t* data, uint32_t address);
+	uint8_t pickJob(uint8_t* stream, uint8_t* buffer);
+	uint8_t findBuffer(Stream& stream, uint32_t address);
+	void reposition(Stream& stream, uint32_t address);
+	uint8_t acquire();
+
+public:
+
+	MidiPrefetcher(uint8_t (*file_read_fnct)(void),
+			void (*file_fseek_fnct)(uint32_t address),
+			uint8_t (*file_eof_fnct)(void));
+
+	~MidiPrefetcher();
+
+	/* Control functions */
+
+	void start();
+
+	void stop();
+
+	void setUnderrunPolicy(uint8_t policy);
+
+	/* File source functions */
+
+	uint8_t read();
+
+	void seek(uint32_t address, uint8_t owner);
+
+	uint32_t tell() const;
+
+	uint8_t eof() const;
+
+	/* Statistics functions */
+
+	uint32_t getFills() const;
+
+	uint32_t getUnderruns() const;
+
+	uint32_t getSyncReads() const;
+
+	uint32_t getStallTime() const; // In microseconds
+
+	void resetStats();
+};
+
+#endif /* MIDIPREFETCHER_HPP_ */
@@ -0,0 +1,155 @@
+/*
+ * See header file for details
+ *
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ *
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ *
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+/* Includes */
+#include <stdio.h>
+#include "MidiTracer.hpp"
+
+MidiTracer* midi_tracer = 0;
+
+MidiTracer::MidiTracer(uint32_t (*us_clock_fnct)(void)) :
+		us_clock_fnct(us_clock_fnct) {
+	clear();
+}
+
+void MidiTracer::attach() {
+	midi_tracer = this;
+}
+
+void MidiTracer::detach() {
+	if (midi_tracer == this)
+		midi_tracer = 0;
+}
+
+void MidiTracer::clear() {
+	head = 0;
+	count = 0;
+	overwritten = 0;
+	traceOrigin = us_clock_fnct();
+	songOrigin = traceOrigin;
+}
+
+uint32_t MidiTracer::now() const {
+	return us_clock_fnct();
+}
+
+void MidiTracer::record(uint32_t start, uint8_t kind, uint8_t lane,
+		uint8_t detail, uint32_t arg) {
+	Span& span = spans[head];
+	span.start = start;
+	span.duration = us_clock_fnct() - start;
+	span.arg = arg;
+	span.kind = kind;
+	span.lane = lane;
+	span.detail = detail;
+
+	head = (head + 1) % TRACE_RING_SIZE;
+	if (count < TRACE_RING_SIZE)
+		count++;
+	else
+		overwritten++;
+}
+
+void MidiTracer::songStart() {
+	songOrigin = us_clock_fnct();
+}
+
+const char* MidiTracer::spanName(const Span& span) {
+	static const char* const channelEvents[] = { "Note Off", "Note On",
+			"Key After Touch", "Control Change", "Patch Change",
+			"Channel After Touch", "Pitch Bend" };
+
+	switch (span.kind) {
+	case TRACE_REFILL:
+		return "Refill";
+	case TRACE_UNDERRUN:
+		return "Underrun";
+	case TRACE_WAIT:
+		return "Wait";
+	}
+
+	if (span.detail == 0xFF)
+		return "Meta";
+	if (span.detail == 0xF0 || span.detail == 0xF7)
+		return "Sysex";
+	if (span.detail >= 0x80 && span.detail < 0xF0)
+		return channelEvents[(span.detail >> 4) - 8];
+	return "Event";
+}
+
+void MidiTracer::dump(void (*print_fnct)(const char* text)) const {
+	static const char* const categories[] = { "io", "io", "decode", "wait",
+			"callback" };
+	char buf[200];
+	uint16_t i;
+	uint8_t lane;
+
+	print_fnct("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	// Lanes names
+	for (lane = 0; lane <= TRACE_LANE_FILE; lane++) {
+		if (lane < MAX_TRACKS_NUMBERS)
+			snprintf(buf, sizeof(buf),
+					"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Track %u\"}},\n",
+					lane, lane);
+		else
+			snprintf(buf, sizeof(buf),
+					"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n",
+					lane,
+					(lane == TRACE_LANE_SCHEDULER) ? "Scheduler" : "File");
+		print_fnct(buf);
+	}
+
+	// Spans, oldest first
+	for (i = 0; i < count; i++) {
+		const Span& span = spans[(head + TRACE_RING_SIZE - count + i)
+				% TRACE_RING_SIZE];
+		int n = snprintf(buf, sizeof(buf),
+				"{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lu,\"dur\":%lu,\"args\":{",
+				spanName(span), categories[span.kind], span.lane,
+				(unsigned long) (span.start - traceOrigin),
+				(unsigned long) span.duration);
+
+		if (span.kind == TRACE_CALLBACK) // Scheduled song time vs actual
+			snprintf(buf + n, sizeof(buf) - n,
+					"\"status\":%u,\"scheduled\":%lu,\"actual\":%lu,\"drift\":%ld}},\n",
+					span.detail, (unsigned long) span.arg,
+					(unsigned long) (span.start - songOrigin),
+					(long) (int32_t) (span.start - songOrigin - span.arg));
+		else if (span.kind == TRACE_WAIT)
+			snprintf(buf + n, sizeof(buf) - n, "\"requested\":%lu}},\n",
+					(unsigned long) span.arg);
+		else
+			snprintf(buf + n, sizeof(buf) - n, "\"address\":%lu}},\n",
+					(unsigned long) span.arg);
+		print_fnct(buf);
+	}
+
+	// Closing marker (JSON do not allow a trailing comma)
+	snprintf(buf, sizeof(buf),
+			"{\"name\":\"Dump\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%u,\"ts\":%lu}\n]}\n",
+			TRACE_LANE_SCHEDULER,
+			(unsigned long) (us_clock_fnct() - traceOrigin));
+	print_fnct(buf);
+}
+
+uint16_t MidiTracer::getCount() const {
+	return count;
+}
+
+uint32_t MidiTracer::getOverwritten() const {
+	return overwritten;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file MidiTracer.hpp
+ * @brief Timeline tracer for the GenericMidiParser (Chrome trace / Perfetto output)
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * The tracer record spans for I/O refills, events decoding, scheduler waits and callbacks\n
+ * into a preallocated ring (the oldest spans are overwritten).\n
+ * dump() write the ring as Chrome trace JSON, which can be opened with Perfetto (ui.perfetto.dev)\n
+ * or chrome://tracing. Each track get its own lane, callbacks spans give the scheduled song time\n
+ * and the drift of the actual dispatch time.\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ *
+ * @section other_sec Others notes and compatibility warning
+ * Tracing points are only compiled when ENABLE_TRACE is defined (for every files of the library),\n
+ * otherwise the TRACE macros expand to nothing.\n
+ * The tracer in use is the one given to attach(), it is not thread safe (playback thread only).
+ */
+
+#ifndef MIDITRACER_HPP_
+#define MIDITRACER_HPP_
+
+#include <stdint.h>
+#include "GenericMidiParser.hpp" // MAX_TRACKS_NUMBERS
+
+/**
+ * Trace output
+ */
+//#define ENABLE_TRACE
+
+/**
+ * Define (if not allready) the number of spans kept in the ring
+ */
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 1024
+#endif
+
+/**
+ * Lanes other than tracks lanes (0 to MAX_TRACKS_NUMBERS - 1)
+ */
+#define TRACE_LANE_SCHEDULER MAX_TRACKS_NUMBERS
+#define TRACE_LANE_FILE (MAX_TRACKS_NUMBERS + 1)
+
+class MidiTracer;
+
+/**
+ * Tracer in use (0 if none)
+ */
+extern MidiTracer* midi_tracer;
+
+/**
+ * Tracing points
+ */
+#ifdef ENABLE_TRACE
+#define TRACE_BEGIN(var) uint32_t var = midi_tracer ? midi_tracer->now() : 0
+#define TRACE_END(var, kind, lane, detail, arg) { if (midi_tracer) midi_tracer->record(var, kind, lane, detail, arg); }
+#define TRACE_SONG_START() { if (midi_tracer) midi_tracer->songStart(); }
+#else
+#define TRACE_BEGIN(var)
+#define TRACE_END(var, kind, lane, detail, arg) {}
+#define TRACE_SONG_START() {}
+#endif
+
+/**
+ * MidiTracer class
+ */
+class MidiTracer {
+
+public:
+
+	/**
+	 * Enumeration of span kinds
+	 */
+	enum {
+		TRACE_REFILL, // arg = file address
+		TRACE_UNDERRUN, // arg = file address
+		TRACE_DECODE, // detail = status, arg = file address
+		TRACE_WAIT, // arg = requested delay in microseconds
+		TRACE_CALLBACK, // detail = status, arg = scheduled song time in microseconds
+	};
+
+private:
+	/**
+	 * Recorded span structure
+	 */
+	typedef struct {
+		uint32_t start; // Clock time in microseconds
+		uint32_t duration;
+		uint32_t arg;
+		uint8_t kind;
+		uint8_t lane;
+		uint8_t detail;
+	} Span;
+
+	/* Ring */
+	Span spans[TRACE_RING_SIZE];
+	uint16_t head, count;
+	uint32_t overwritten;
+
+	/* Time origins */
+	uint32_t traceOrigin, songOrigin;
+
+	/* Low-level functions */
+	uint32_t (*us_clock_fnct)(void);
+
+	/* Usefull functions */
+	static const char* spanName(const Span& span);
+
+public:
+
+	MidiTracer(uint32_t (*us_clock_fnct)(void));
+
+	/* Control functions */
+
+	void attach(); // Become the tracer in use
+
+	void detach();
+
+	void clear();
+
+	/* Recording functions (see TRACE macros) */
+
+	uint32_t now() const;
+
+	void record(uint32_t start, uint8_t kind, uint8_t lane, uint8_t detail,
+			uint32_t arg);
+
+	void songStart();
+
+	/* Output functions */
+
+	void dump(void (*print_fnct)(const char* text)) const;
+
+	/* Statistics functions */
+
+	uint16_t getCount() const;
+
+	uint32_t getOverwritten() const;
+};
+
+#endif /* MIDITRACER_HPP_ */
@@ -0,0 +1,160 @@
+/*
+ * See header file for details
+ *
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ *
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ *
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+/* Includes */
+#include "MidiTransform.hpp"
+
+MidiTransform::MidiTransform() {
+	reset();
+}
+
+void MidiTransform::reset() {
+	uint8_t i, j;
+	for (i = 0; i < 128; i++) {
+		keyMap[i] = i;
+		velocityMap[i] = i;
+	}
+	for (i = 0; i < 16; i++) {
+		channelMap[i] = i;
+		for (j = 0; j < 128; j++)
+			sounding[i][j] = NOT_SOUNDING;
+	}
+}
+
+void MidiTransform::setTranspose(int8_t semitones) {
+	for (int16_t i = 0; i < 128; i++)
+		keyMap[i] = (i + semitones >= 0 && i + semitones < 128) ?
+				i + semitones : (uint8_t) KEY_REMOVED;
+}
+
+void MidiTransform::setKeyMap(const uint8_t* map) {
+	for (uint8_t i = 0; i < 128; i++)
+		keyMap[i] = (map[i] < 128) ? map[i] : (uint8_t) KEY_REMOVED;
+}
+
+void MidiTransform::setVelocityScale(uint8_t percent) {
+	uint16_t velocity;
+	velocityMap[0] = 0;
+	for (uint8_t i = 1; i < 128; i++) {
+		velocity = ((uint16_t) i * percent) / 100;
+		velocityMap[i] = (velocity > 127) ? 127 : (velocity < 1) ? 1 : velocity;
+	}
+}
+
+void MidiTransform::setVelocityCurve(const uint8_t* curve) {
+	velocityMap[0] = 0; // A note on must stay a note on
+	for (uint8_t i = 1; i < 128; i++)
+		velocityMap[i] = (curve[i] > 127) ? 127 : (curve[i] < 1) ? 1 : curve[i];
+}
+
+void MidiTransform::setChannelMap(uint8_t from, uint8_t to) {
+	channelMap[from & 0x0F] = to & 0x0F;
+}
+
+uint16_t MidiTransform::fillBatch(GenericMidiParser* parser,
+		MidiEventBatch* batch) {
+	MidiEvent event;
+	uint16_t i;
+
+	batch->count = 0;
+	while (batch->count < TRANSFORM_BATCH_SIZE
+			&& parser->nextEvent(&event, false)) {
+		i = batch->count++;
+		batch->time[i] = event.time;
+		batch->track[i] = event.track;
+		batch->status[i] = event.status;
+		batch->data1[i] = event.data[0];
+		batch->data2[i] = event.data[1];
+		if (event.status >= 0xF0) { // Not a channel event, dispatched by the consumer in order
+			batch->system = event;
+			break; // Its payload is readable until the next event is pulled
+		}
+	}
+
+	return batch->count;
+}
+
+void MidiTransform::apply(MidiEventBatch* batch) {
+	uint8_t inStatus[TRANSFORM_BATCH_SIZE], inKey[TRANSFORM_BATCH_SIZE];
+	uint8_t key[TRANSFORM_BATCH_SIZE], velocity[TRANSFORM_BATCH_SIZE],
+			channel[TRANSFORM_BATCH_SIZE];
+	uint8_t* status = batch->status;
+	uint8_t* data1 = batch->data1;
+	uint8_t* data2 = batch->data2;
+	uint16_t i, count = batch->count;
+
+	// Lookup tables pass
+	for (i = 0; i < count; i++) {
+		inStatus[i] = status[i];
+		inKey[i] = data1[i];
+		key[i] = keyMap[data1[i] & 0x7F];
+		velocity[i] = velocityMap[data2[i] & 0x7F];
+		channel[i] = channelMap[status[i] & 0x0F];
+	}
+
+	// Select pass, branch free so the compiler can vectorize it
+	for (i = 0; i < count; i++) {
+		uint8_t type = status[i] & 0xF0;
+		uint8_t isKey = -(uint8_t) ((type == 0x80) | (type == 0x90)
+				| (type == 0xA0));
+		uint8_t isNoteOn = -(uint8_t) (type == 0x90);
+		uint8_t isValid = -(uint8_t) (type != 0);
+		uint8_t isSystem = -(uint8_t) (type == 0xF0);
+		status[i] = ((type | channel[i]) & isValid & ~isSystem)
+				| (status[i] & isSystem);
+		data1[i] = (key[i] & isKey) | (data1[i] & ~isKey);
+		data2[i] = (velocity[i] & isNoteOn) | (data2[i] & ~isNoteOn);
+	}
+
+	// Notes pairing pass, a note off (or key after touch) go where its note on went
+	for (i = 0; i < count; i++) {
+		uint8_t type = inStatus[i] & 0xF0;
+
+		if (type != 0x80 && type != 0x90 && type != 0xA0)
+			continue;
+
+		uint16_t& note = sounding[inStatus[i] & 0x0F][inKey[i] & 0x7F];
+		if (type == 0xA0) {
+			if (note != NOT_SOUNDING) {
+				status[i] = 0xA0 | ((note >> 8) & 0x0F);
+				data1[i] = note & 0x7F;
+			} else if (data1[i] == KEY_REMOVED)
+				status[i] = 0;
+			continue;
+		}
+		if (type == 0x90 && data2[i] != 0) { // Note on
+			if (note != NOT_SOUNDING) { // Retrigger, same output key as the first note on
+				status[i] = 0x90 | ((note >> 8) & 0x0F);
+				data1[i] = note & 0x7F;
+				if ((note >> 12) < 15)
+					note += 0x1000;
+				continue;
+			}
+			if (data1[i] == KEY_REMOVED) {
+				status[i] = 0;
+				continue;
+			}
+			note = 0x1000 | ((status[i] & 0x0F) << 8) | data1[i];
+		} else if (note != NOT_SOUNDING) { // Note off of a transformed note on
+			status[i] = (status[i] & 0xF0) | ((note >> 8) & 0x0F);
+			data1[i] = note & 0x7F;
+			note -= 0x1000;
+			if ((note >> 12) == 0) // Last note off
+				note = NOT_SOUNDING;
+		} else if (data1[i] == KEY_REMOVED)
+			status[i] = 0;
+	}
+}
@@ -0,0 +1,114 @@
+/**
+ * @file MidiTransform.hpp
+ * @brief Batch transform stage (transpose, velocity curve, channel remap) for the GenericMidiParser
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * Channel events are pulled from the parser by batches stored in a structure of arrays,\n
+ * then transformed with lookup tables in plain loops the compiler can vectorize.\n
+ * The output key and channel of each sounding note is remembered, so the matching note off\n
+ * is always sent to the same key even if the tables are changed in the middle of a song.\n
+ * A retriggered note go to the output key of its first note on, and the mapping is kept until its last note off.\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ *
+ * @section other_sec Others notes and compatibility warning
+ * A meta or sysex event end the batch, so it is never dispatched ahead of the notes before it :\n
+ * it is the last entry (status 0xF0, 0xF7 or 0xFF, left untouched by apply()) and the whole event is kept in system.\n
+ * Give it to the parser dispatchEvent() when its time come (its payload can be read from the callback until the next fillBatch()).\n
+ * Batches are pulled without delay, use the time array to schedule the output.\n
+ * Events removed by the transform (note mapped out of range) have a status of 0.\n
+ * The sounding notes table take 4KB of RAM, this stage is designed for PC or big micro-controllers.
+ */
+
+#ifndef MIDITRANSFORM_HPP_
+#define MIDITRANSFORM_HPP_
+
+#include <stdint.h>
+#include "GenericMidiParser.hpp"
+
+/**
+ * Define (if not allready) the number of events per batch
+ */
+#ifndef TRANSFORM_BATCH_SIZE
+#define TRANSFORM_BATCH_SIZE 64
+#endif
+
+/**
+ * Batch of channel events (structure of arrays)
+ */
+typedef struct {
+	uint32_t time[TRANSFORM_BATCH_SIZE]; // Absolute time in microseconds
+	uint8_t track[TRANSFORM_BATCH_SIZE];
+	uint8_t status[TRANSFORM_BATCH_SIZE]; // Channel included, 0 = removed
+	uint8_t data1[TRANSFORM_BATCH_SIZE];
+	uint8_t data2[TRANSFORM_BATCH_SIZE];
+	uint16_t count;
+	MidiEvent system; // Meta or sysex event ending the batch, if any
+} MidiEventBatch;
+
+/**
+ * MidiTransform class
+ */
+class MidiTransform {
+
+public:
+
+	/**
+	 * Special values
+	 */
+	enum {
+		KEY_REMOVED = 0xFF, NOT_SOUNDING = 0xFFFF,
+	};
+
+private:
+	/* Lookup tables */
+	uint8_t keyMap[128];
+	uint8_t velocityMap[128];
+	uint8_t channelMap[16];
+
+	/* Note on count << 12 | output channel << 8 | output key of each sounding input note */
+	uint16_t sounding[16][128];
+
+public:
+
+	MidiTransform();
+
+	/* Configuration functions */
+
+	void reset();
+
+	void setTranspose(int8_t semitones);
+
+	void setKeyMap(const uint8_t* map);
+
+	void setVelocityScale(uint8_t percent);
+
+	void setVelocityCurve(const uint8_t* curve);
+
+	void setChannelMap(uint8_t from, uint8_t to);
+
+	/* Processing functions */
+
+	static uint16_t fillBatch(GenericMidiParser* parser, MidiEventBatch* batch);
+
+	void apply(MidiEventBatch* batch);
+};
+
+#endif /* MIDITRANSFORM_HPP_ */
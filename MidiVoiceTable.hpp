@@ -0,0 +1,74 @@
+/**
+ * @file MidiVoiceTable.hpp
+ * @brief Voices bookkeeping interface between the GenericMidiParser and a voice tracker
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * When a voice table is given to the parser, every note on and note off go through it\n
+ * before being dispatched, and allNotesOff() release the voices it still hold.\n
+ * The parser only call it through this interface, so programs which do not use a voice tracker\n
+ * do not have to build nor link MidiVoiceTracker.cpp.\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+
+#ifndef MIDIVOICETABLE_HPP_
+#define MIDIVOICETABLE_HPP_
+
+#include <stdint.h>
+
+/**
+ * Sounding voice structure
+ */
+typedef struct {
+	uint32_t startTime; // Absolute time in microseconds
+	uint8_t port;
+	uint8_t channel;
+	uint8_t key;
+	uint8_t velocity;
+	uint8_t count; // Note on received for this key (retriggers included)
+} MidiVoice;
+
+/**
+ * MidiVoiceTable interface
+ */
+class MidiVoiceTable {
+
+public:
+
+	/**
+	 * Enumeration of note on results
+	 */
+	enum {
+		VOICE_DROPPED, VOICE_STARTED, VOICE_STOLEN,
+	};
+
+	virtual uint8_t noteOn(uint8_t channel, uint8_t key, uint8_t velocity,
+			uint32_t time, MidiVoice* stolen, uint8_t port) = 0;
+
+	virtual uint8_t noteOff(uint8_t channel, uint8_t key, uint8_t port) = 0;
+
+	virtual uint8_t popVoice(MidiVoice* voice) = 0;
+
+protected:
+	~MidiVoiceTable() {
+	}
+};
+
+#endif /* MIDIVOICETABLE_HPP_ */
@@ -0,0 +1,172 @@
+/*
+ * See header file for details
+ *
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ *
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ *
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ */
+/* Includes */
+#include "MidiVoiceTracker.hpp"
+
+#define NO_VOICE 0xFF
+
+MidiVoiceTracker::MidiVoiceTracker() :
+		activeVoices(0), highWater(0), limit(VOICE_TRACKER_MAX_VOICES), policy(
+				STEAL_OLDEST) {
+	reset();
+}
+
+void MidiVoiceTracker::setPolyphonyLimit(uint8_t limit, uint8_t policy) {
+	if (limit == 0 || limit > VOICE_TRACKER_MAX_VOICES)
+		limit = VOICE_TRACKER_MAX_VOICES;
+	this->limit = limit;
+	this->policy = policy;
+}
+
+void MidiVoiceTracker::reset() {
+	for (uint8_t i = 0; i < 16; i++)
+		for (uint8_t j = 0; j < 16; j++)
+			sounding[i][j] = 0;
+	activeVoices = 0;
+}
+
+uint8_t MidiVoiceTracker::findVoice(uint8_t channel, uint8_t key,
+		uint8_t port) const {
+	for (uint8_t i = 0; i < activeVoices; i++)
+		if (voices[i].channel == channel && voices[i].key == key
+				&& voices[i].port == port)
+			return i;
+	return NO_VOICE;
+}
+
+uint8_t MidiVoiceTracker::isSoundingAnyPort(uint8_t channel,
+		uint8_t key) const {
+	return (sounding[channel][key >> 3] >> (key & 7)) & 1;
+}
+
+uint8_t MidiVoiceTracker::pickVictim() const {
+	uint8_t i, victim = 0;
+
+	for (i = 1; i < activeVoices; i++)
+		if (policy == STEAL_QUIETEST) {
+			if (voices[i].velocity < voices[victim].velocity
+					|| (voices[i].velocity == voices[victim].velocity
+							&& voices[i].startTime < voices[victim].startTime))
+				victim = i;
+		} else if (voices[i].startTime < voices[victim].startTime)
+			victim = i;
+
+	return victim;
+}
+
+void MidiVoiceTracker::removeVoice(uint8_t index) {
+	uint8_t channel = voices[index].channel, key = voices[index].key;
+	voices[index] = voices[--activeVoices]; // Keep the array compact
+
+	// Clear the bit when the key is not sounding on another port
+	for (uint8_t i = 0; i < activeVoices; i++)
+		if (voices[i].channel == channel && voices[i].key == key)
+			return;
+	sounding[channel][key >> 3] &= ~(1 << (key & 7));
+}
+
+uint8_t MidiVoiceTracker::noteOn(uint8_t channel, uint8_t key,
+		uint8_t velocity, uint32_t time, MidiVoice* stolen, uint8_t port) {
+	uint8_t result = VOICE_STARTED;
+	uint8_t index;
+	channel &= 0x0F;
+	key &= 0x7F;
+
+	index = isSoundingAnyPort(channel, key) ?
+			findVoice(channel, key, port) : NO_VOICE;
+	if (index != NO_VOICE) { // Retrigger
+		if (voices[index].count < 0xFF)
+			voices[index].count++;
+	} else {
+		if (activeVoices >= limit) {
+			if (policy == STEAL_NONE)
+				return VOICE_DROPPED;
+			index = pickVictim();
+			*stolen = voices[index];
+			stolen->count = 1;
+			removeVoice(index);
+			result = VOICE_STOLEN;
+		}
+		index = activeVoices++;
+		voices[index].count = 1;
+		sounding[channel][key >> 3] |= 1 << (key & 7);
+		if (activeVoices > highWater)
+			highWater = activeVoices;
+	}
+
+	voices[index].startTime = time;
+	voices[index].port = port;
+	voices[index].channel = channel;
+	voices[index].key = key;
+	voices[index].velocity = velocity;
+	return result;
+}
+
+uint8_t MidiVoiceTracker::noteOff(uint8_t channel, uint8_t key,
+		uint8_t port) {
+	uint8_t index;
+	channel &= 0x0F;
+	key &= 0x7F;
+
+	if (!isSoundingAnyPort(channel, key))
+		return false;
+	index = findVoice(channel, key, port);
+	if (index == NO_VOICE)
+		return false; // Sounding on another port only
+	if (--voices[index].count == 0)
+		removeVoice(index);
+	return true;
+}
+
+uint8_t MidiVoiceTracker::popVoice(MidiVoice* voice) {
+	if (activeVoices == 0)
+		return false;
+	*voice = voices[activeVoices - 1];
+	voice->count = 1;
+	if (--voices[activeVoices - 1].count == 0)
+		removeVoice(activeVoices - 1);
+	return true;
+}
+
+uint8_t MidiVoiceTracker::isSounding(uint8_t channel, uint8_t key,
+		uint8_t port) const {
+	channel &= 0x0F;
+	key &= 0x7F;
+	if (!isSoundingAnyPort(channel, key))
+		return false;
+	return findVoice(channel, key, port) != NO_VOICE;
+}
+
+const MidiVoice* MidiVoiceTracker::getVoice(uint8_t channel, uint8_t key,
+		uint8_t port) const {
+	uint8_t index = findVoice(channel & 0x0F, key & 0x7F, port);
+	if (index == NO_VOICE)
+		return 0;
+	return &voices[index];
+}
+
+uint8_t MidiVoiceTracker::getActiveVoices() const {
+	return activeVoices;
+}
+
+uint8_t MidiVoiceTracker::getHighWater() const {
+	return highWater;
+}
+
+void MidiVoiceTracker::resetHighWater() {
+	highWater = activeVoices;
+}
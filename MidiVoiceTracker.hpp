@@ -0,0 +1,113 @@
+/**
+ * @file MidiVoiceTracker.hpp
+ * @brief Active voices table for the GenericMidiParser
+ * @author SkyWodd
+ * @version 2.0
+ * @see http://skyduino.wordpress.com/
+ *
+ * @section intro_sec Introduction
+ * This table know which notes are sounding, with a 128 bits bitset per channel\n
+ * and a compact array of voices (port, channel, key, velocity, start time).\n
+ * Voices are identified by their output port, channel and key, so the same note on several ports never collide.\n
+ * It can limit the polyphony for synthetisers with a fixed number of voices.\n
+ * \n
+ * Please report bug to <skywodd at gmail.com>
+ *
+ * @section licence_sec Licence
+ *  This program is free software: you can redistribute it and/or modify\n
+ *  it under the terms of the GNU General Public License as published by\n
+ *  the Free Software Foundation, either version 3 of the License, or\n
+ *  (at your option) any later version.\n
+ * \n
+ *  This program is distributed in the hope that it will be useful,\n
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of\n
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n
+ *  GNU General Public License for more details.\n
+ * \n
+ *  You should have received a copy of the GNU General Public License\n
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.\n
+ *
+ * @section other_sec Others notes and compatibility warning
+ * getActiveVoices() and getHighWater() are O(1), isSounding() is O(1) when the key is not sounding on any port.\n
+ * Per voice queries, note off and stealing scan the voices array (at most VOICE_TRACKER_MAX_VOICES entries).\n
+ * A retriggered key stay one voice, it is released by its last note off (popVoice() return it once per note on).
+ */
+
+#ifndef MIDIVOICETRACKER_HPP_
+#define MIDIVOICETRACKER_HPP_
+
+#include <stdint.h>
+#include "MidiVoiceTable.hpp"
+
+/**
+ * Define (if not allready) the maximum number of simultaneous voices
+ */
+#ifndef VOICE_TRACKER_MAX_VOICES
+#define VOICE_TRACKER_MAX_VOICES 32
+#endif
+
+/**
+ * MidiVoiceTracker class
+ */
+class MidiVoiceTracker: public MidiVoiceTable {
+
+public:
+
+	/**
+	 * Enumeration of voice stealing policies
+	 */
+	enum {
+		STEAL_NONE, // Drop the new note
+		STEAL_OLDEST,
+		STEAL_QUIETEST,
+	};
+
+private:
+	/* Sounding notes */
+	uint8_t sounding[16][16]; // 128 bits per channel, set if sounding on any port
+	MidiVoice voices[VOICE_TRACKER_MAX_VOICES];
+	uint8_t activeVoices, highWater;
+
+	/* Polyphony limit */
+	uint8_t limit, policy;
+
+	/* Usefull functions */
+	uint8_t findVoice(uint8_t channel, uint8_t key, uint8_t port) const;
+	uint8_t isSoundingAnyPort(uint8_t channel, uint8_t key) const;
+	uint8_t pickVictim() const;
+	void removeVoice(uint8_t index);
+
+public:
+
+	MidiVoiceTracker();
+
+	/* Configuration functions */
+
+	void setPolyphonyLimit(uint8_t limit, uint8_t policy);
+
+	void reset();
+
+	/* Update functions */
+
+	uint8_t noteOn(uint8_t channel, uint8_t key, uint8_t velocity,
+			uint32_t time, MidiVoice* stolen, uint8_t port = 0);
+
+	uint8_t noteOff(uint8_t channel, uint8_t key, uint8_t port = 0);
+
+	uint8_t popVoice(MidiVoice* voice);
+
+	/* Query functions */
+
+	uint8_t isSounding(uint8_t channel, uint8_t key, uint8_t port = 0) const;
+
+	const MidiVoice* getVoice(uint8_t channel, uint8_t key,
+			uint8_t port = 0) const;
+
+	uint8_t getActiveVoices() const;
+
+	uint8_t getHighWater() const;
+
+	void resetHighWater();
+};
+
+#endif /* MIDIVOICETRACKER_HPP_ */
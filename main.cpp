@@ -1,6 +1,7 @@
 /* Includes */
 #include <stdio.h>
 #include "GenericMidiParser.hpp"
+#include "MidiPageCache.hpp"
 
 FILE *fi;
 
@@ -32,6 +33,8 @@ void assert_error_callback(uint8_t errorCode) {
 	printf("Error : %d\n", errorCode);
 }
 
+MidiPageCache cache(file_read_fnct, file_fseek_fnct, file_eof_fnct);
+
 GenericMidiParser midi(file_read_fnct, file_fseek_fnct, file_ftell_fnct,
 		file_eof_fnct, us_delay_fnct, assert_error_callback);
 
@@ -96,6 +99,8 @@ int main(void) {
 		return 1;
 	}
 
+	midi.setFileSource(&cache);
+
 	midi.setNoteOnCallback(note_on_callback);
 	midi.setNoteOffCallback(note_off_callback);
 	midi.setKeyAfterTouchCallback(key_after_touch_callback);
@@ -109,5 +114,9 @@ int main(void) {
 
 	midi.play();
 
+	printf("Cache : %u hits, %u misses, %u seeks, hit rate %d%%\n",
+			cache.getHits(), cache.getMisses(), cache.getPhysicalSeeks(),
+			cache.getHitRate());
+
 	return 0;
 }
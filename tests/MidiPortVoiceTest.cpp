@@ -0,0 +1,100 @@
+/*
+ * Regression check : a track sent to port 1 by its port prefix, through the port router and the voice tracker.
+ * Each note off must reach port 1 when it is read, not only through allNotesOff() at the end of the song.
+ *
+ * Build and run from the repository root :
+ * g++ -I. tests/MidiPortVoiceTest.cpp GenericMidiParser.cpp MidiVoiceTracker.cpp MidiPortRouter.cpp -o port_voice_test && ./port_voice_test
+ */
+/* Includes */
+#include <stdio.h>
+#include "GenericMidiParser.hpp"
+#include "MidiVoiceTracker.hpp"
+#include "MidiPortRouter.hpp"
+
+/* One track file : port prefix 1, note 60 retriggered, then released twice */
+const uint8_t song[] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x01, 0xE0,
+		'M', 'T', 'r', 'k', 0, 0, 0, 25, //
+		0x00, 0xFF, 0x21, 0x01, 0x01, // Port prefix
+		0x00, 0x90, 60, 100, //
+		0x10, 0x90, 60, 90, // Retrigger
+		0x10, 0x80, 60, 0, //
+		0x10, 0x80, 60, 0, //
+		0x00, 0xFF, 0x2F, 0x00 };
+uint32_t position;
+
+/* Low-level functions */
+uint8_t file_read_fnct(void) {
+	return (position < sizeof(song)) ? song[position++] : 0;
+}
+
+void file_fseek_fnct(uint32_t address) {
+	position = address;
+}
+
+uint32_t file_ftell_fnct(void) {
+	return position;
+}
+
+uint8_t file_eof_fnct(void) {
+	return position >= sizeof(song);
+}
+
+void us_delay_fnct(uint32_t us) {
+	(void) us;
+}
+
+void assert_error_callback(uint8_t errorCode) {
+	printf("Error : %d\n", errorCode);
+}
+
+/* Port writers */
+uint8_t noteOffs[2];
+
+void port0_writer(const uint8_t* data, uint8_t length) {
+	(void) length;
+	if ((data[0] & 0xF0) == 0x80)
+		noteOffs[0]++;
+}
+
+void port1_writer(const uint8_t* data, uint8_t length) {
+	(void) length;
+	if ((data[0] & 0xF0) == 0x80 && data[1] == 60)
+		noteOffs[1]++;
+}
+
+int main(void) {
+	GenericMidiParser midi(file_read_fnct, file_fseek_fnct, file_ftell_fnct,
+			file_eof_fnct, us_delay_fnct, assert_error_callback);
+	MidiVoiceTracker tracker;
+	MidiPortRouter router(0);
+	MidiEvent event;
+	uint8_t failed = 0;
+
+	router.setWriter(0, port0_writer);
+	router.setWriter(1, port1_writer);
+	midi.setVoiceTracker(&tracker);
+	midi.setPortRouter(&router);
+
+	if (midi.load())
+		return 1;
+	while (midi.nextEvent(&event, false)) {
+		midi.dispatchEvent(&event);
+		router.drain(0, ROUTER_QUEUE_SIZE);
+		router.drain(1, ROUTER_QUEUE_SIZE);
+	}
+
+	// Before allNotesOff() : both note offs delivered, nothing left sounding
+	if (noteOffs[1] != 2 || noteOffs[0] != 0) {
+		printf("FAIL : %d note off on port 1, %d on port 0 (expected 2 and 0)\n",
+				noteOffs[1], noteOffs[0]);
+		failed = 1;
+	}
+	if (tracker.getActiveVoices() != 0) {
+		printf("FAIL : %d voices still sounding\n", tracker.getActiveVoices());
+		failed = 1;
+	}
+
+	if (!failed)
+		printf("PASS\n");
+	return failed;
+}